@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <sys/utsname.h>
 #include <pthread.h>
@@ -10,83 +11,252 @@
 #include <math.h>
 #include <sys/time.h>
 #include <sched.h>
+#include <fcntl.h>
 #include "lcd.h"
+#include "periodic.h"
+#include "sensor_state.h"
+#include "sysfs_node.h"
+#include "history.h"
+#include "event_loop.h"
+#include "hx711.h"
+#include "hal.h"
+#include "latency.h"
+#include "trace.h"
+#include "store.h"
+#include "status.h"
+#include "query.h"
+#include "config.h"
+#include "calib.h"
+#include <sys/signalfd.h>
+#include <sys/epoll.h>
 #define NUM_VALID_DEVICES 2
 #define MAX_BUFFER_SIZE 100
+#define MAX_KEGS HX711_MAX_CELLS
+// how long the weight worker waits for the HX711s to finish a conversion
+// (10 samples per second)
+#define HX711_READY_TIMEOUT_MS 150
+// readings averaged for every calibration point
+#define CALIB_CAPTURE_SAMPLES 16
 
 struct device_t {
     // index 0 corresponds to a first device and 1 to a second device
+    // for the weight sensor: 0 is the HX711 PD_SCK and 1 its DOUT
      int32_t gpio_numbers[NUM_VALID_DEVICES];
 };
 
+// everything the monitor keeps per keg
+struct keg_t {
+    struct device_t weightSensor;
+    // load cell calibration from the config or captured with -C, used to
+    // compute the grams and % of beer remaining in the keg
+    struct calib_table calibration;
+    bool calibrated;
+    // shared variables, published by the sampling tasks through a seqlock so
+    // readers never block the higher priority writers
+    struct sensor_state sensors;
+    // weight samples and filters, only touched by the weight worker
+    struct sample_history weightHistory;
+    // index of the keg's temperature probe in probes, -1 without one
+    int32_t probe;
+};
+
 
-static const char *GPIO_Path = (char *) "/sys/class/gpio/";
-static const char *TEMP_PATH = (char *) "/sys/bus/w1/devices/28-2b46d446b48a/hwmon/hwmon0/";
+static const char *W1_PATH = (char *) "/sys/bus/w1/devices/";
 
-static void *modifyLED(void* arg);
-static void *monitorTemperature(void* arg);
-static void *monitorWeight(void* arg);
+static void modifyLED(struct event_source *source);
+static void closeScreens();
+static void monitorTemperature(void *arg);
+static void monitorWeight(void* arg);
+static void handleSignals(struct event_source *source);
+static void syncStores(struct event_source *source);
+static void publishStatus(struct event_source *source);
+static void resumeRecord(const struct store_record *record, void *arg);
+static void resumeHistory();
 
-static int32_t promptUserForGPIOS(struct device_t *devices, int32_t * isTemp);
-static int32_t writeGPIO(int32_t gpio_number, char *output);
+static int32_t configureKegs();
+static int32_t findProbe(const char *id, int32_t resolution);
+static void assignProbes();
+static int32_t writeGPIO(struct sysfs_node *node, char *output);
 static int32_t initializeDevices(struct device_t *devices);
-static int32_t initializeSensors(struct device_t *devices);
+static int32_t openWeightCells();
 static int32_t start_system();
+static void startDevices();
+static void *startDisplay(void *arg);
+static void *startProbe(void *arg);
 static bool handleUnsafeOperations();
-static double readGPIO(int32_t gpio_number, int32_t);
-static int32_t promptUserForkegWeight(double * kegWeight);
-static double convertToPercentage();
+static int32_t readGPIO(int32_t handle, int64_t *millidegrees);
+static void openSensorHandles();
+static int32_t promptUserForGrams(int32_t *grams);
+static int32_t averageCounts(int32_t k, int32_t *counts);
+static int32_t weighKeg(int32_t k, const struct calib_config *calib, int32_t *grams);
+static int32_t calibrateKegs();
+static double convertToGrams(const struct keg_t *keg, const struct sensor_reading *weight);
+static double convertToPercentage(const struct keg_t *keg, const struct sensor_reading *weight);
 
 // structs placed in global scope for eventual cleanup
 static struct device_t displaySensor= {0};
-static int32_t temperatureSensor_gpio=1 ;
-static struct device_t weightSensor= {0};
-
-// locks
-static pthread_mutex_t weight_mutex;
-static pthread_mutex_t temperature_mutex; 
-
-// shared variables
-double current_weight=-1;
-double current_temperature=-1;
-// user inputted values obtained during the initialization of the system
-// used to compute the % of beer remaining in the keg
-double EmptykegWeight=-1;
-double FullkegWeight=-1;
-
-// custom single handler for SIGINT
-// for proper system shutdown
-static void handler(int32_t sig) {
-clearDisplay();    
-i2c_stop();
-    // int32_t i;
-    // int32_t result;
-     printf("Caught Signal %d: Working on clean shutdown...\n", sig);
-
-    // // note: nothing down with error return values since shutting down anyways
-    // for (i = 0; i < NUM_VALID_DEVICES; i++) {
-    //     result = writeGPIO(temperatureSensor_gpio, "0");//EDIT HERE
-    //     if (result != 0) {
-    //         printf("Error occurred while attempting to turn off GPIO pin %d. Continuing with shutdown...\n", result);
-    //     }
-    // }
-    exit(0);
-}
-
-int main(){
-    int32_t display_flag=-1;
-    int32_t weight_flag=-1;
-    int32_t temp_flag=-1;
-    int32_t signal_num = SIGINT;
-    int32_t device_flag = -1;
-    int32_t keg_weight_flag=-1;
+static struct keg_t kegs[MAX_KEGS];
+static int32_t numKegs = 1;
+
+// an LCD and what it shows, opened from a display of the config
+struct screen_t {
+    struct lcd_display *lcd;
+    int32_t cols;
+    int32_t rows;
+    int32_t keg;            // keg shown, -1 for all of them
+    int32_t page;           // shown next, past the last page is the overview
+};
+static struct screen_t screens[CONFIG_MAX_DISPLAYS];
+static int32_t numScreens = 0;
+static void drawScreen(struct screen_t *screen);
+
+// the HX711s of every keg share one PD_SCK and are read in a single clock-out
+static bool weightCellsOpen = false;
+
+// a DS18B20 in use, opened once by openSensorHandles() and kept open.
+// kegs without a probe of their own share one
+struct probe_t {
+    char id[W1_ID_SIZE];
+    int32_t resolution;
+    int32_t handle;
+    // samples and filters of the probe, only touched by the temperature worker
+    struct sample_history history;
+};
+static struct probe_t probes[W1_MAX_PROBES];
+static int32_t numProbes = 0;
+
+// everything but the sensor reads runs as sources of one event loop on the
+// main thread; the display and temperature probe are shared by all kegs
+static struct event_loop loop;
+static struct event_source displaySource = { .name = "modifyLED", .handler = modifyLED };
+// SIGUSR1 prints the latency histograms of every task, SIGUSR2 writes the
+// binary trace to config.trace_file and SIGINT shuts down. read from a
+// signalfd so all of it runs on the event loop and not in a signal handler,
+// which could cut into an LCD write
+static struct event_source signalSource = { .name = "signals", .handler = handleSignals };
+
+// history and calibration on disk, so a restart picks up where it left off.
+// each worker appends to its own store, weightStore or temperatureStore,
+// storeSource commits both every STORE_SYNC_MS
+static bool storesOpen = false;
+static struct sample_store weightStore;
+static struct sample_store temperatureStore;
+static struct event_source storeSource = { .name = "syncStores", .handler = syncStores };
+#define STORE_SYNC_MS 10000
+// how far back a restart looks for the last readings
+#define STORE_RESUME_NS (600 * 1000000000LL)
+
+// status of every keg in /dev/shm for other processes (kegstatus,
+// dashboards), rewritten by the event loop every STATUS_PERIOD_MS
+static struct status_map statusMap;
+static bool statusOpen = false;
+static struct event_source statusSource = { .name = "publishStatus", .handler = publishStatus };
+#define STATUS_PERIOD_MS 1000
+// a reading older than this many periods of its task is reported stale
+#define STATUS_STALE_PERIODS 3
+#define WEIGHT_PERIOD_MS 1000
+#define TEMPERATURE_PERIOD_MS 5000
+
+// snapshot, recent samples and range queries for other processes on a Unix
+// socket, served by the event loop
+static struct query_server queryServer;
+static bool queryOpen = false;
+
+// the HX711 clock-out is latency critical, so it keeps a dedicated worker.
+// it gets its own core in real-time mode since HX711 sampling jitter is the
+// main source of bad readings. the DS18B20 takes up to 750 ms per
+// conversion, its worker waits for it so the event loop never does
+static struct periodic_task workers[] = {
+    { .name = "monitorWeight", .period_ms = WEIGHT_PERIOD_MS, .priority = 3, .own_core = true,
+      .init = NULL, .handler = monitorWeight, .arg = NULL },
+    { .name = "monitorTemperature", .period_ms = TEMPERATURE_PERIOD_MS, .priority = 2, .own_core = false,
+      .init = NULL, .handler = monitorTemperature, .arg = NULL },
+};
+#define NUM_WORKERS (sizeof(workers) / sizeof(workers[0]))
+// priority of the event loop thread in real-time mode, below the workers
+#define EVENT_LOOP_PRIORITY 1
+
+// wiring, calibration and paths, from /etc/kegmon.conf (-c) and the command
+// line, so the monitor starts without anyone at the console
+static struct monitor_config config;
+#define OPTIONS "c:o:rsk:t:d:q:C"
+// when main() started, to report how long the first screen took
+static struct timespec startTime;
+// filter settings: EMA weight of the newest median, and how far from the
+// median a sample may be (fraction of the keg range, degrees C)
+#define WEIGHT_EMA_ALPHA 0.3
+#define WEIGHT_OUTLIER_FRACTION 0.1
+#define TEMPERATURE_EMA_ALPHA 0.5
+#define TEMPERATURE_OUTLIER_LIMIT 5.0
+
+int main(int argc, char *argv[]){
+    const char *configPath = CONFIG_PATH;
+    bool configGiven = false;
+    bool calibrate = false;
     int32_t result = 0;
-    struct sigaction sa = {0};
-
-     // Install Signal Handler for SIGINT
-    sa.sa_handler = handler;
-    result = sigaction(signal_num, &sa, (void *) ((int32_t) 0));
     struct utsname unameData;
+    int32_t opt;
+
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    config_defaults(&config);
+
+    // the file is read first so every other option overrides it
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        if (opt == 'c') {
+            configPath = optarg;
+            configGiven = true;
+        }
+    }
+    result = config_load(&config, configPath);
+    if (result == -1 || (result != 0 && configGiven)) {
+        printf("Error: could not read %s\n", configPath);
+        exit(EXIT_FAILURE);
+    }
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        if (opt == 'c') {
+            result = 0;
+        } else if (opt == 'C') {
+            calibrate = true;
+        } else if (opt == 'o') {
+            result = config_override(&config, optarg);
+        } else if (opt == 'r') {
+            result = config_set(&config, "realtime", "yes");
+        } else if (opt == 's') {
+            result = config_set(&config, "sim", "yes");
+        } else if (opt == 'k') {
+            result = config_set(&config, "kegs", optarg);
+        } else if (opt == 't') {
+            result = config_set(&config, "trace_file", optarg);
+        } else if (opt == 'd') {
+            result = config_set(&config, "store_dir", optarg);
+        } else if (opt == 'q') {
+            result = config_set(&config, "query_socket", optarg);
+        } else {
+            result = -1;
+        }
+        if (result != 0) {
+            printf("usage: %s [-c config] [-o key=value] [-C] [-r] [-s] [-k kegs] [-t trace_file] [-d store_dir] [-q socket]\n"
+                   "  -c  config file (default %s)\n"
+                   "  -C  capture the load cell calibration at the console, save it and exit\n"
+                   "  -o  set one config key, wins over the file\n"
+                   "  -r  real-time mode (SCHED_FIFO, pinned weight task, locked memory)\n"
+                   "  -s  run against simulated sensors and LCD instead of the board\n"
+                   "  -k  number of kegs to monitor, 1 to %d\n"
+                   "  -t  where SIGUSR2 and shutdown write the binary trace\n"
+                   "  -d  directory of the sample history and calibration\n"
+                   "  -q  Unix socket of the query server\n", argv[0], CONFIG_PATH, MAX_KEGS);
+            exit(EXIT_FAILURE);
+        }
+    }
+    numKegs = config.kegs;
+    if (config.sim) {
+        hal = &hal_sim;
+    }
+
+    // a query client that hangs up mid answer must not kill the monitor
+    signal(SIGPIPE, SIG_IGN);
 
     if (uname(&unameData) != 0) {
         perror("uname");
@@ -94,270 +264,315 @@ int main(){
     }
 
     printf("%s %s %s %s %s\n", unameData.sysname, unameData.nodename, unameData.release, unameData.version, unameData.machine);
-    sleep(5);
-    if (result == 0) {
-        // prompt and obtain input from the user for the gpiopins to be used for the weight sensor
-        printf("Enter GPIO Input for Weight Sensor: \n");
-        //function to ask for dislayScreen motor and piezo motor input 
-        weight_flag= promptUserForGPIOS(&weightSensor,0);
-
-        if (weight_flag==0) {
-            // prompt and obtain input from the user for the gpio pin to be used for the temperature sensor
-            printf("Enter GPIO Input for Temperature Sensor: \n");
-            temp_flag = promptUserForGPIOS(NULL, &temperatureSensor_gpio);
-
-            if(temp_flag==0){
-                // prompt the user for calibration values utilized in the computation of the % Beer Remaining
-                printf("Enter weight of Empty KEG: \n");
-                keg_weight_flag=  promptUserForkegWeight(&EmptykegWeight);
-
-                if(keg_weight_flag==0){
-                    printf("Enter weight of full KEG: \n");
-                    keg_weight_flag=  promptUserForkegWeight(&FullkegWeight);
-                }
-            }
+    if (result != 0 || configureKegs() != 0) {
+        printf("INPUT module Failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (calibrate) {
+        exit(calibrateKegs() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    if (start_system() == 1){
+        printf("EXITING CODE");
+    }
+    return 0;
+}
+
+// takes the wiring and calibration of every keg from the config. a keg
+// without calibration there uses the one captured with -C.
+// returns 0 on success
+static int32_t configureKegs() {
+    struct calib_config calibration[MAX_KEGS];
+    bool saved = store_load_calibration(config.store_dir, calibration, (uint32_t) numKegs) == 0;
+
+    for (int32_t k = 0; k < numKegs; k++) {
+        const struct keg_config *wiring = &config.keg[k];
+        const struct calib_config *calib = NULL;
+        struct keg_t *keg = &kegs[k];
+
+        if (wiring->dout < 0) {
+            printf("Error: no DOUT GPIO for keg %d, set keg%d.dout\n", k + 1, k + 1);
+            return 1;
+        }
+        keg->weightSensor.gpio_numbers[0] = wiring->sck;
+        keg->weightSensor.gpio_numbers[1] = wiring->dout;
+
+        if (wiring->calibrated) {
+            calib = &wiring->calib;
+        } else if (saved) {
+            calib = &calibration[k];
+        }
+        if (calib != NULL && calib_build(&keg->calibration, calib) != 0) {
+            printf("Error: keg %d calibration is invalid, points must ascend and the full keg must be heavier\n", k + 1);
+            return 1;
         }
-        
-        // check if the initialization was successful
-        if (weight_flag == 0 && temp_flag==0) {
-            printf("Weight Sensor GPIOs- %d, %d\n",weightSensor.gpio_numbers[0],weightSensor.gpio_numbers[1]);
-            printf("Temperature GPIO- %d\n", temperatureSensor_gpio);
-            printf("Empty Keg is %.0lf\n\n", EmptykegWeight);
-            printf("Full Keg is %.0lf\n\n", FullkegWeight);
-            printf("Input module SUCCESSFULL\n");
-            printf("\n");
-            printf("\n");
+        keg->calibrated = calib != NULL;
+
+        printf("Keg %d Weight Sensor GPIOs- %d, %d\n", k + 1, keg->weightSensor.gpio_numbers[0], keg->weightSensor.gpio_numbers[1]);
+        if (keg->calibrated) {
+            printf("Tare %d, %u reference points, Empty Keg is %d g, Full Keg is %d g\n",
+                   calib->tare, calib->points, calib->empty, calib->full);
         } else {
-            printf("INPUT module Failed\n");
-            printf("\n");
-            printf("\n");
-            exit(0);
+            // the percentage reads 0 until it is calibrated
+            printf("Warning: keg %d is not calibrated, run with -C or set keg%d.empty and keg%d.full\n", k + 1, k + 1, k + 1);
         }
+    }
+    assignProbes();
+    return 0;
+}
 
-    device_flag = -1;
+// index of the probe with id, added at resolution when it is new
+static int32_t findProbe(const char *id, int32_t resolution) {
+    for (int32_t p = 0; p < numProbes; p++) {
+        if (strcmp(probes[p].id, id) == 0) {
+            return p;
+        }
+    }
+    if (numProbes == W1_MAX_PROBES) {
+        return -1;
+    }
+    snprintf(probes[numProbes].id, sizeof(probes[numProbes].id), "%s", id);
+    probes[numProbes].resolution = resolution;
+    probes[numProbes].handle = -1;
+    return numProbes++;
+}
 
-    // initialize the gpio pins utilized for the weight sensor
-    // currently this code won't do anything besides setting the inputted gpios to receive input 
-    // due to the weight sensor being unsuccessfully implemented
-    device_flag = initializeSensors(&weightSensor);
-    printf("weight init with %d\n",device_flag);
+// gives every keg its probe: the one set with kegN.w1 or w1, otherwise the
+// next probe found on the bus that no keg was given explicitly. kegs left
+// over show the first keg's probe, as when the cooler had only one
+static void assignProbes() {
+    char found[W1_MAX_PROBES][W1_ID_SIZE];
+    int32_t numFound = hal->temperature_discover(found, W1_MAX_PROBES);
+    int32_t next = 0;
+
+    for (int32_t k = 0; k < numKegs; k++) {
+        kegs[k].probe = config.keg[k].w1_id[0] == '\0' ? -1 :
+                        findProbe(config.keg[k].w1_id, config.keg[k].resolution);
+    }
+    for (int32_t k = 0; k < numKegs; k++) {
+        if (config.keg[k].w1_id[0] != '\0') {
+            continue;
+        }
+        // skip the probes set explicitly for other kegs
+        while (next < numFound) {
+            bool claimed = false;
+            for (int32_t j = 0; j < numKegs; j++) {
+                claimed = claimed || strcmp(config.keg[j].w1_id, found[next]) == 0;
+            }
+            if (!claimed) {
+                break;
+            }
+            next++;
+        }
+        if (next < numFound) {
+            kegs[k].probe = findProbe(found[next++], config.keg[k].resolution);
+        } else {
+            kegs[k].probe = k > 0 ? kegs[0].probe : -1;
+        }
+    }
 
-    if (device_flag == 0) {
-           // i2c_init();
-    } else {
-        printf("Device flag is not 0 \n");
+    printf("%d temperature probes found\n", numFound);
+    for (int32_t k = 0; k < numKegs; k++) {
+        if (kegs[k].probe < 0) {
+            printf("Warning: keg %d has no temperature probe\n", k + 1);
+        } else {
+            printf("Keg %d Temperature probe- %s, %d bits\n", k + 1, probes[kegs[k].probe].id, probes[kegs[k].probe].resolution);
+        }
     }
+}
 
-    // checks if the initialization of all devices was successful
-    if (device_flag == 0) {
-        // starts the system
-        if (start_system() == 1){
-            printf("EXITING CODE");
+// mean of CALIB_CAPTURE_SAMPLES raw readings of keg k. returns 0 on success
+static int32_t averageCounts(int32_t k, int32_t *counts) {
+    uint32_t raw[MAX_KEGS];
+    int64_t sum = 0;
+
+    for (int32_t i = 0; i < CALIB_CAPTURE_SAMPLES; i++) {
+        // only this keg's cell has to be ready
+        if (hal->weight_wait_ready(HX711_READY_TIMEOUT_MS) != 0 && (hal->weight_busy() & (1u << k))) {
+            printf("Error: no reading from keg %d\n", k + 1);
+            return 1;
         }
+        hal->weight_read(raw);
+        sum += HX711_SIGN_EXTEND(raw[k]);
     }
-  }  
-  return 0;
+    *counts = (int32_t) (sum / CALIB_CAPTURE_SAMPLES);
+    return 0;
 }
 
-// prompts the user for the gpios associated with a specific device
-// for devices that require two gpios, provide a pointer to the device_t struct
-// that stores the gpios. in the case where a device only requires one gpio
-// (such as the temperature sensor), provide a NULL argument for the devices and
-// a pointer to the int variable that will store the gpio value
-static int32_t promptUserForGPIOS(struct device_t *devices, int32_t *isTemp){
-   char buffer[MAX_BUFFER_SIZE] = {0};
-    // used to check if fgets was successful
-    char *fgets_flag = NULL;
-    // used to check if sscanf was successful
-    int32_t sscanf_flag = EOF;
-    int32_t result = 1;
-   
-    for( int32_t i=0; i<NUM_VALID_DEVICES; i++){
-        // note: fgets + sscanf used instead of scanf for memory safety
-        fgets_flag = fgets((char *) buffer, MAX_BUFFER_SIZE, stdin);
-
-        if (fgets_flag != NULL) {
-            printf("Enter GPIO: \n");
-            // for when you need one gpio for a device
-             if(devices==NULL && isTemp){
-                sscanf_flag = sscanf(buffer, "%d", isTemp);
-                printf("temp GPIO Input recorded: %d \n", *isTemp);
-                 if (sscanf_flag == 1) {
-                    result = 0;
-                }
+// grams on keg k's platform by the reference loads captured so far
+static int32_t weighKeg(int32_t k, const struct calib_config *calib, int32_t *grams) {
+    struct calib_config partial = *calib;
+    struct calib_table table;
+    int32_t counts;
+
+    partial.empty = 0;
+    partial.full = 1;
+    if (calib_build(&table, &partial) != 0 || averageCounts(k, &counts) != 0) {
+        return 1;
+    }
+    *grams = calib_grams(&table, counts);
+    return 0;
+}
+
+// captures the calibration of every keg at the console: the tare, known
+// loads and the empty and full keg. saves it where the next start loads it
+// and prints it as config lines. returns 0 on success
+static int32_t calibrateKegs() {
+    struct calib_config calibration[MAX_KEGS] = {0};
+    int32_t result = 0;
+
+    if (openWeightCells() != 0) {
+        printf("Error: the weight sensors are needed for the calibration\n");
+        return 1;
+    }
+    for (int32_t k = 0; k < numKegs; k++) {
+        struct calib_config *calib = &calibration[k];
+        int32_t grams;
+
+        printf("Keg %d: clear the platform and press Enter\n", k + 1);
+        if (promptUserForGrams(&grams) < 0 || averageCounts(k, &calib->tare) != 0) {
+            return 1;
+        }
+        printf("Tare is %d\n", calib->tare);
+
+        while (calib->points < CALIB_MAX_POINTS) {
+            struct calib_point *point = &calib->point[calib->points];
+            int32_t counts;
+
+            printf("Keg %d: put a known weight on the platform and enter its grams, or press Enter when done\n", k + 1);
+            result = promptUserForGrams(&point->grams);
+            if (result == 1) {
                 break;
-            }else{
-                sscanf_flag = sscanf(buffer, "%d", &devices->gpio_numbers[i]);
-                printf("GPIO Input recorded: %d \n", devices->gpio_numbers[i]);
             }
-          
-            if (sscanf_flag == 1) {
-                result = 0;
+            if (result != 0 || averageCounts(k, &counts) != 0) {
+                return 1;
+            }
+            point->raw = counts - calib->tare;
+            printf("%d g reads %d above the tare\n", point->grams, point->raw);
+            // every load has to be heavier and read higher than the one before
+            if (point->raw <= (calib->points == 0 ? 0 : point[-1].raw) ||
+                point->grams <= (calib->points == 0 ? 0 : point[-1].grams)) {
+                printf("Error: not above the previous load, try again\n");
+                continue;
             }
+            calib->points++;
+        }
+
+        // with nothing entered the keg is weighed on the platform
+        printf("Keg %d: enter the grams of the empty keg, or put it on the platform and press Enter\n", k + 1);
+        result = promptUserForGrams(&calib->empty);
+        if (result < 0 || (result == 1 && weighKeg(k, calib, &calib->empty) != 0)) {
+            return 1;
+        }
+        printf("Keg %d: enter the grams of the full keg, or put it on the platform and press Enter\n", k + 1);
+        result = promptUserForGrams(&calib->full);
+        if (result < 0 || (result == 1 && weighKeg(k, calib, &calib->full) != 0)) {
+            return 1;
+        }
+        if (calib_build(&kegs[k].calibration, calib) != 0) {
+            printf("Error: keg %d calibration is invalid, points must ascend and the full keg must be heavier\n", k + 1);
+            return 1;
         }
     }
-    printf("\n");
-    printf("\n");
 
-    return result;
-}
+    printf("# calibration, saved to %s/calibration\n", config.store_dir);
+    for (int32_t k = 0; k < numKegs; k++) {
+        const struct calib_config *calib = &calibration[k];
 
+        printf("keg%d.tare = %d\n", k + 1, calib->tare);
+        for (uint32_t i = 0; i < calib->points; i++) {
+            printf("keg%d.point = %d:%d\n", k + 1, calib->point[i].raw, calib->point[i].grams);
+        }
+        printf("keg%d.empty = %d\nkeg%d.full = %d\n", k + 1, calib->empty, k + 1, calib->full);
+    }
+    return store_save_calibration(config.store_dir, calibration, (uint32_t) numKegs) == 0 ? 0 : 1;
+}
 
-// retrieves input from the user regarding the weight of the keg
-static int32_t promptUserForkegWeight(double *kegWeight){
+// retrieves a weight in grams from the user. returns 0 for a number, 1 for
+// an empty line and -1 when the input ended or isn't a number
+static int32_t promptUserForGrams(int32_t *grams){
    char buffer[MAX_BUFFER_SIZE] = {0};
     // used to check if fgets was successful
     char *fgets_flag = NULL;
     // used to check if sscanf was successful
     int32_t sscanf_flag = EOF;
-    int32_t result = 1;
-    
+    int32_t result = -1;
+
     fgets_flag = fgets((char *) buffer, MAX_BUFFER_SIZE, stdin);
 
     if (fgets_flag != NULL) {
-        sscanf_flag = sscanf(buffer, "%lf", kegWeight);
-        printf("KEG Weight recorded: %.2lf \n",*kegWeight);
+        sscanf_flag = sscanf(buffer, "%d", grams);
 
         if (sscanf_flag == 1) {
             result = 0;
+        } else if (sscanf_flag == EOF) {
+            result = 1;
         }
     }
-
-    printf("\n");
-    printf("\n");
-
     return result;
 }
 
-// used to initialize the direction values of the weight sensor's GPIOs
-// note: this code will not currently impact the system due to the 
-// weight sensor not being able to be implemented
-static int32_t initializeSensors(struct device_t *devices) {
-    int32_t j;
-    int32_t cur_gpio_num;
-    int32_t result = 0;
-    int32_t flag;
-    char direction_path[MAX_BUFFER_SIZE] = {0};
-    FILE *fp = NULL;
-
-    for (j = 0; j < NUM_VALID_DEVICES; j++) {
-        cur_gpio_num = devices->gpio_numbers[j];
-        result = cur_gpio_num;
-
-        // open direction file
-        flag = snprintf(direction_path, MAX_BUFFER_SIZE, "%sgpio%d/direction", GPIO_Path, cur_gpio_num);
-        printf("weight path - %s\n",direction_path);
-        // check that no error occurred during the writing of direction_path
-        if (flag >= 0) {
-            fp = fopen(direction_path, "w");
-
-            // check that file was successfully opened
-            if (fp != NULL) {
-                flag = fprintf(fp, "in");
-
-                // check that file was successfully written to
-                if (flag >= 0) {
-                    flag = fclose(fp);
-                    if (flag != EOF) {
-                        result = 0;
-                    }
-                } else {
-                    flag = fclose(fp);
-                }
-            }
+// opens the value files read by the sampling tasks. a file that can't be
+// opened is reported and readGPIO() fails for it
+static void openSensorHandles() {
+    char path[SYSFS_PATH_SIZE] = {0};
+
+    // the gpio associated with the temperature sensor has been reconfigured
+    // to receive bus communication, so its value comes from the w1 device
+    for (int32_t p = 0; p < numProbes; p++) {
+        if (snprintf(path, sizeof(path), "%s%s", W1_PATH, probes[p].id) >= (int) sizeof(path)) {
+            printf("Error: w1 path of probe %s is too long\n", probes[p].id);
+            probes[p].handle = -1;
+            continue;
         }
-        if (result != 0) {
-            break;
-        }                
+        probes[p].handle = hal->temperature_open(path, probes[p].resolution);
     }
-    return result;
 }
 
+// maps the HX711s of all kegs for the weight worker. the kegs share the
+// PD_SCK of the first keg, and every DOUT has to be on the same GPIO bank.
+// returns 0 on success
+static int32_t openWeightCells() {
+    int32_t dout_pins[MAX_KEGS];
+    int32_t sck = kegs[0].weightSensor.gpio_numbers[0];
+
+    for (int32_t k = 0; k < numKegs; k++) {
+        if (kegs[k].weightSensor.gpio_numbers[0] != sck) {
+            printf("Error: keg %d uses PD_SCK %d, all kegs must share PD_SCK %d\n",
+                   k + 1, kegs[k].weightSensor.gpio_numbers[0], sck);
+            return 1;
+        }
+        dout_pins[k] = kegs[k].weightSensor.gpio_numbers[1];
+    }
+    if (hal->weight_open(sck, dout_pins, (size_t) numKegs) != 0) {
+        return 1;
+    }
+    weightCellsOpen = true;
+    return 0;
+}
 
 // write a value to the gpio's associated value file
-static int32_t writeGPIO(int32_t gpio_number, char *output) {
-    FILE *fp = NULL;
-    char path[MAX_BUFFER_SIZE] = {0};
-    int32_t result = gpio_number;
-    int32_t flag = 0;
-
-    // open value file
-    flag = snprintf(path, MAX_BUFFER_SIZE, "%sgpio%d/value", GPIO_Path, gpio_number);
-
-    // check that no errors occurred while writing to path
-    if (flag >= 0) {
-        fp = fopen(path, "w");
-
-        // check that the specified file was opened correctly
-        if (fp != NULL) {
-            flag = fprintf(fp, "%s", output);
-
-            // check that the output was written out to the file without error
-            if (flag >= 0) {
-                flag = fclose(fp);
-
-                // check if file was closed without error 
-                if (flag == 0) {
-                    result = 0;
-                }
-            } else {
-                flag = fclose(fp);
-            }  
-        }     
+static int32_t writeGPIO(struct sysfs_node *node, char *output) {
+    if (node->fd < 0 || sysfs_write(node, output) != 0) {
+        printf("Error: could not write %s to %s\n", output, node->path);
+        return 1;
     }
-    return result;
+    return 0;
 }
 
-// read a value stored in a sensor's associated gpio value file
-// for temperature, the gpio associated with the temperature sensor
-// has been reconfigured to receive bus communication. 
-// thus, when reading the data from the temperature sensor we read 
-// data from the path to its associated file in the /sys/bus/ folders
-static double readGPIO(int32_t gpio_number, int32_t isTemp) {
-    FILE *fp = NULL;
-    char path[MAX_BUFFER_SIZE] = {0};
-    int32_t flag = -1;
-    double result = -1;
-    char value[60];
-    char buffer[MAX_BUFFER_SIZE] = {0};
-    if(!isTemp){
-    // open value file
-        flag = snprintf(path, MAX_BUFFER_SIZE, "%sgpio%d/value", GPIO_Path, gpio_number);
-    }else{
-        // open value file
-        flag = snprintf(path, MAX_BUFFER_SIZE, "%s/temp1_input", TEMP_PATH);
-        //printf("Temp input is %s\n",path);
-    }
- 
-    // check that path was correctly written to
-    if (flag >= 0) {
-        fp = fopen(path, "r");
-        // check that file opened successfully
-        if (fp != NULL) {
-            if(fgets(value, 60, fp)!=NULL){
-                 char *endptr;
-                result = strtod(value, &endptr);
-                // Check if conversion was successful
-                if (*endptr != '\0' && *endptr != '\n') {
-                    printf("Error: Invalid Value was written to GPIO pin %d's value file.\n", gpio_number);
-                    result = -1;
-                }
-                //printf("RESULT- %f\n",result);
-
-            }
-            else{ 
-                printf("Error: Invalid Value was written to GPIO pin %d's value file.\n", gpio_number);
-            }
-
-            flag = fclose(fp);
-
-            if (flag != 0) {
-                printf("Error with closing GPIO's value file.\n;");
-                result = -1;
-            }
-        }
+// read the temperature probe's value, temp1_input in millidegrees.
+// on the board this costs a single pread() on the already open file.
+// returns 0 on success, 1 when the probe isn't open or can't be read
+static int32_t readGPIO(int32_t handle, int64_t *millidegrees) {
+    if (handle < 0) {
+        return 1;
     }
-    return result;
+    // errors go to the trace, stdio would stall the sampling thread
+    if (hal->temperature_read(handle, millidegrees) != 0) {
+        trace(TRACE_SENSOR_ERROR, (uint16_t) handle, 0);
+        return 1;
+    }
+    trace(TRACE_SENSOR_READ, (uint16_t) handle, (uint32_t) *millidegrees);
+    return 0;
 }
 
 
@@ -370,188 +585,483 @@ static double readGPIO(int32_t gpio_number, int32_t isTemp) {
 
 static int32_t start_system()
 {
+    for (int32_t k = 0; k < numKegs; k++) {
+        history_init(&kegs[k].weightHistory, WEIGHT_EMA_ALPHA,
+                     !kegs[k].calibrated ? 0 :
+                     WEIGHT_OUTLIER_FRACTION * (calib_raw(&kegs[k].calibration, kegs[k].calibration.full) -
+                                                calib_raw(&kegs[k].calibration, kegs[k].calibration.empty)));
+    }
+    for (int32_t p = 0; p < numProbes; p++) {
+        history_init(&probes[p].history, TEMPERATURE_EMA_ALPHA, TEMPERATURE_OUTLIER_LIMIT);
+    }
 
-    pthread_attr_t temperature_attr, display_attr, weight_attr;
-    int32_t tempR=0,display=0,wght=0;
-
-    // Initialize attributes for each thread
-    tempR= pthread_attr_init(&temperature_attr);
-    display= pthread_attr_init(&display_attr);
-    wght= pthread_attr_init(&weight_attr);
-
-    if(tempR || display || wght){
-        printf("Error initializing attributes\n\n");
-    }
-
-   struct sched_param param_temperature, param_display, param_weight;
-
-    tempR= pthread_attr_getschedparam(&temperature_attr, &param_temperature);
-    display=pthread_attr_getschedparam(&display_attr, &param_display);
-    wght=pthread_attr_getschedparam(&weight_attr, &param_weight);
-    
-    
-    // printf("Getting schedular params  tempR -%d\n",tempR);
-    // printf("Getting schedular params  display -%d\n",display);
-    // printf("Getting schedular params  wght -%d\n",wght);
-
-
-    tempR = pthread_attr_setschedpolicy(&temperature_attr, SCHED_FIFO);
-    display = pthread_attr_setschedpolicy(&display_attr, SCHED_FIFO);
-    wght = pthread_attr_setschedpolicy(&weight_attr, SCHED_FIFO);
-    
-    // printf("Setting policy  tempR -%d\n",tempR);
-    // printf("Setting policy display -%d\n",display);
-    // printf("Setting policy  wght -%d\n",wght);
-    
-    // param_temperature.sched_priority = 3; // Lower priority for tempR
-    // param_display.sched_priority = 1;   // Higher priority for display device
-    // param_weight.sched_priority = 2;   // Medium priority for wght lights
-
-    param_temperature.sched_priority = 1; // Lowest priority for tempR
-    param_display.sched_priority = 2;   // 2nd highest priority for display device
-    param_weight.sched_priority = 3;   // Highest priority for wght lights
-
-    tempR= pthread_attr_setschedparam(&temperature_attr, &param_temperature);
-    display=pthread_attr_setschedparam(&display_attr, &param_display);
-    wght=pthread_attr_setschedparam(&weight_attr, &param_weight);
-    
-    // printf("setting schedular params  tempR -%d\n",tempR);
-    // printf("setting schedular params  display -%d\n",display);
-    // printf("setting schedular params  wght -%d\n",wght);    
- 
-    
-    pthread_t temperature_device,display_device, weight_device;
-
-      
-    if(pthread_create(&temperature_device,&temperature_attr, monitorTemperature, NULL)!=0)
-    {  
-        perror("Error creating train thread \n");
-        printf("with error %d ",tempR);
-        exit(1);
+    // keep this thread, and so every thread it creates, off the weight
+    // worker's core
+    periodic_reserve_cores(workers, NUM_WORKERS, config.realtime);
+
+    // block SIGINT, SIGUSR1 and SIGUSR2 before any thread is created, the
+    // store archivers being the first, so only the signalfd sees them. a
+    // SIGINT during startup shuts down once the event loop runs
+    sigset_t handledSignals;
+    sigemptyset(&handledSignals);
+    sigaddset(&handledSignals, SIGINT);
+    sigaddset(&handledSignals, SIGUSR1);
+    sigaddset(&handledSignals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &handledSignals, NULL);
+
+    // without the store the monitor still runs, it just forgets on restart
+    if (store_open(&weightStore, config.store_dir, "weight") == 0 &&
+        store_open(&temperatureStore, config.store_dir, "temperature") == 0) {
+        storesOpen = true;
+        resumeHistory();
+    } else {
+        printf("Warning: no sample history in %s, continuing without it\n", config.store_dir);
     }
+    statusOpen = status_create(&statusMap, (uint32_t) numKegs) == 0;
+
+    // block SIGUSR1 and SIGUSR2 before any thread is created so only the
+    // signalfd sees them
+    sigset_t dumpSignal;
+    sigemptyset(&dumpSignal);
+    sigaddset(&dumpSignal, SIGUSR1);
+    sigaddset(&dumpSignal, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &dumpSignal, NULL);
+
+    startDevices();
+
+    // lock the process in RAM before the worker stack is created so it
+    // is locked too. failures are reported and the system keeps running
+    if (config.realtime) {
+        struct sched_param param = { .sched_priority = EVENT_LOOP_PRIORITY };
+
+        periodic_lock_memory();
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            printf("Warning: no real-time privileges for the event loop, using normal scheduling\n");
+        }
+    }
+
+    trace_thread("eventLoop");
 
-    if(pthread_create(&display_device, &display_attr, modifyLED , NULL)!=0)
-    {
-        perror("Error creating display sensor thread \n");
+    if (event_loop_init(&loop) != 0 ||
+        event_loop_add_timer(&loop, &displaySource, 3000) != 0 ||
+        (storesOpen && event_loop_add_timer(&loop, &storeSource, STORE_SYNC_MS) != 0) ||
+        (statusOpen && event_loop_add_timer(&loop, &statusSource, STATUS_PERIOD_MS) != 0) ||
+        event_loop_add_fd(&loop, &signalSource, signalfd(-1, &handledSignals, SFD_NONBLOCK | SFD_CLOEXEC), EPOLLIN) != 0) {
         exit(1);
     }
-    
-    if(pthread_create(&weight_device, &weight_attr, monitorWeight , NULL)!=0)
-    {
-        perror("Error creating wght lights thread \n");
+
+    struct query_backend backend = {
+        .status = statusOpen ? &statusMap : NULL,
+        .weight = storesOpen ? &weightStore : NULL,
+        .temperature = storesOpen ? &temperatureStore : NULL,
+    };
+    queryOpen = query_start(&queryServer, &loop, config.query_socket, &backend) == 0;
+    if (!queryOpen) {
+        printf("Warning: no query server on %s, continuing without it\n", config.query_socket);
+    }
+
+    // the HX711 clock-out and the probe run on their own threads released on
+    // absolute deadlines
+    if (periodic_start(workers, NUM_WORKERS, config.realtime) != 0) {
+        perror("Error creating worker threads \n");
         exit(1);
-    }   
-
-    pthread_join(temperature_device,NULL);
-    pthread_join(display_device,NULL);
-    pthread_join(weight_device,NULL);
-    
-    // Cleanup attributes (optional)
-
-    pthread_cancel(temperature_device);
-    pthread_cancel(display_device);
-    pthread_cancel(weight_device);
-    pthread_attr_destroy(&temperature_attr);
-    pthread_attr_destroy(&display_attr);
-    pthread_attr_destroy(&weight_attr);
-          
+    }
+
+    event_loop_run(&loop);
+
+    // SIGINT stopped the loop, nothing on it is mid write to the LCD
+    printf("Caught Signal %d: Working on clean shutdown...\n", SIGINT);
+    closeScreens();
+    periodic_report(workers, NUM_WORKERS);
+    event_loop_report(&loop);
+    trace_dump(config.trace_file);
+    if (queryOpen) {
+        query_stop(&queryServer, config.query_socket);
+    }
+    event_loop_close(&loop);
+    // the weight worker runs until exit, so the stores are synced, not
+    // closed under it
+    if (storesOpen) {
+        store_sync(&weightStore);
+        store_sync(&temperatureStore);
+    }
+    if (statusOpen) {
+        status_destroy(&statusMap);
+    }
     printf("cleaning up\n\n");
     return 1;
 }
 
 
-static double convertToPercentage(){
-    pthread_mutex_lock(&weight_mutex);
+// the LCD init sequences, on its own thread during startup. every panel
+// is queued first and they are initialized together in one flush
+static void *startDisplay(void *arg) {
+    (void) arg;
+    trace_thread("startDisplay");
+    for (int32_t d = 0; d < CONFIG_MAX_DISPLAYS; d++) {
+        const struct display_config *display = &config.display[d];
+        struct screen_t *screen = &screens[numScreens];
 
-    double localWeight= current_weight;
+        if (display->addr < 0) {
+            continue;
+        }
+        screen->lcd = lcd_open(display->bus, display->addr, display->cols, display->rows);
+        if (screen->lcd == NULL) {
+            printf("Error: display %d at 0x%02X on %s unavailable, continuing without it\n", d + 1, display->addr, display->bus);
+            continue;
+        }
+        screen->cols = display->cols;
+        screen->rows = display->rows;
+        screen->keg = display->keg - 1;
+        if (screen->keg >= numKegs) {
+            printf("Warning: display %d shows keg %d of %d, showing all of them\n", d + 1, display->keg, numKegs);
+            screen->keg = -1;
+        }
+        screen->page = 0;
+        numScreens++;
+    }
+    lcd_flush();
+    return NULL;
+}
 
-    pthread_mutex_unlock(&weight_mutex);
-    
-    if(localWeight!=-1){
-        localWeight= (localWeight-EmptykegWeight)/FullkegWeight;
-        localWeight*=100;
-    }else{
-        return 0;
+// blanks and releases every LCD
+static void closeScreens() {
+    for (int32_t s = 0; s < numScreens; s++) {
+        lcd_close(screens[s].lcd);
     }
+    numScreens = 0;
+}
 
-    return localWeight;
+// the first temperature conversion, on its own thread during startup
+static void *startProbe(void *arg) {
+    (void) arg;
+    trace_thread("startProbe");
+    openSensorHandles();
+    monitorTemperature(NULL);
+    return NULL;
 }
 
+// brings up the LCD, the probe and the HX711s at the same time, takes a
+// first reading of each and draws the first screen, instead of one device
+// after the other. a device that fails is reported and the monitor runs
+// without it
+static void startDevices() {
+    pthread_t display, probe;
+    bool displayThread = pthread_create(&display, NULL, startDisplay, NULL) == 0;
+    bool probeThread = pthread_create(&probe, NULL, startProbe, NULL) == 0;
+    struct timespec now;
+
+    if (!displayThread) {
+        startDisplay(NULL);
+    }
+    if (!probeThread) {
+        startProbe(NULL);
+    }
 
-// code for thread for monitoring the temperature values from the temperature sensor.
-// period = 5 seconds
-// given lowest period due to utilizing RMS for priority scheduling algorithm
-static void *monitorTemperature(void * arg){
-    struct timeval s,e;
+    // the weight GPIOs are not exported to sysfs: the HX711 backend sets their
+    // direction in the GPIO registers, and an exported DOUT would make the
+    // edge event request fail with EBUSY
+    if (openWeightCells() != 0) {
+        printf("Weight sensors unavailable, continuing without them\n");
+    }
+    // the first weight sample, before the worker owns the filters
+    monitorWeight(NULL);
 
-    pthread_t tid = pthread_self(); 
-    printf("Process ID of monitorTemperature Thread is : %lu\n", tid);
-    struct timeval start_time, current_time;
-    bool resetEvent=false;
+    if (displayThread) {
+        pthread_join(display, NULL);
+    }
+    if (probeThread) {
+        pthread_join(probe, NULL);
+    }
+    modifyLED(NULL);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("First screen %.0f ms after start\n",
+           (now.tv_sec - startTime.tv_sec) * 1e3 + (now.tv_nsec - startTime.tv_nsec) / 1e6);
+}
 
-    //clearDisplay();
 
-    while(true){
-        usleep(5000000);
-        
-        pthread_mutex_lock(&temperature_mutex);
-            current_temperature=readGPIO(temperatureSensor_gpio,1)/1000;
-        pthread_mutex_unlock(&temperature_mutex);
+// grams on the cell for a filtered reading, the raw counts when the keg
+// isn't calibrated
+static double convertToGrams(const struct keg_t *keg, const struct sensor_reading *weight) {
+    if (!keg->calibrated) {
+        return weight->value;
     }
+    return calib_grams(&keg->calibration, (int32_t) weight->value);
+}
 
-    printf("exiting THREAD monitorTemperature\n\n");
-    return NULL;   
+// % of beer remaining between the empty and the full keg, 0 without a
+// reading or calibration
+static double convertToPercentage(const struct keg_t *keg, const struct sensor_reading *weight){
+    if (weight->sequence == 0 || !keg->calibrated) {
+        return 0;
+    }
+    return calib_percent(&keg->calibration, calib_grams(&keg->calibration, (int32_t) weight->value)) / 100.0;
 }
 
 
-// code for thread for monitoring the weight values from the temperature sensor
-// currently not working, due to our group being unable to succesfully implement the weight sensor
+// code for the worker thread monitoring the temperature values from the temperature sensor.
+// period = 5 seconds
+// one conversion is started on every probe at once, slept through holding
+// nothing and picked up when the slowest probe is done, so 8 probes cost
+// one conversion time and no other task ever waits on the 1-wire bus
+static void monitorTemperature(void *arg){
+    struct timespec now;
+    struct timespec wait;
+    int32_t readyMs;
+    int64_t millidegrees[W1_MAX_PROBES];
+    bool valid[W1_MAX_PROBES];
+    double filtered[W1_MAX_PROBES];
+
+    (void) arg;
+    if (numProbes > 0 && hal->temperature_convert(&readyMs) == 0) {
+        wait.tv_sec = readyMs / 1000;
+        wait.tv_nsec = (readyMs % 1000) * 1000000L;
+        nanosleep(&wait, NULL);
+    }
+    for (int32_t p = 0; p < numProbes; p++) {
+        valid[p] = readGPIO(probes[p].handle, &millidegrees[p]) == 0;
+        if (valid[p]) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            filtered[p] = history_push(&probes[p].history, millidegrees[p] / 1000.0, &now);
+        }
+    }
+    for (int32_t k = 0; k < numKegs; k++) {
+        int32_t p = kegs[k].probe;
+
+        // keep showing the last good value when the probe can't be read
+        if (p < 0 || !valid[p]) {
+            continue;
+        }
+        if (storesOpen) {
+            store_append(&temperatureStore, (uint16_t) k, filtered[p], (int32_t) millidegrees[p],
+                         history_latest(&probes[p].history)->rejected ? STORE_REJECTED : 0);
+        }
+        sensor_publish(&kegs[k].sensors.temperature, filtered[p]);
+    }
+}
+
+
+// code for the worker thread reading the weight of every keg from the HX711s
 // period = 1 s
 // given the highest priority due it having the lowest period
-void *monitorWeight(void *arg) {
-    struct timeval s,e;
-    pthread_t tid = pthread_self();
-    printf("Process ID of modifyLED Thread is : %lu\n", tid);
-    
-    while (true) {
-        usleep(1000000);
-          pthread_mutex_lock(&weight_mutex);
-            current_weight=readGPIO(weightSensor.gpio_numbers[0],0);
-        pthread_mutex_unlock(&weight_mutex);
-    }
-    printf("Exiting THREAD modifyLED\n\n");
-    return NULL;
+static void monitorWeight(void *arg) {
+    uint32_t raw[MAX_KEGS];
+    struct timespec now;
+    uint32_t busy = 0;
+
+    (void) arg;
+    if (!weightCellsOpen) {
+        return;
+    }
+    // after a timeout the cells that did convert are still read, so one
+    // dead HX711 doesn't stop the updates of every keg
+    if (hal->weight_wait_ready(HX711_READY_TIMEOUT_MS) != 0) {
+        busy = hal->weight_busy();
+    }
+    if (busy == (1u << numKegs) - 1) {
+        return;
+    }
+    // one shared clock-out samples all kegs at once
+    hal->weight_read(raw);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int32_t k = 0; k < numKegs; k++) {
+        double value = HX711_SIGN_EXTEND(raw[k]);
+        double filtered;
+
+        if (busy & (1u << k)) {
+            continue;
+        }
+        filtered = history_push(&kegs[k].weightHistory, value, &now);
+        trace(TRACE_HX711_READ, (uint16_t) k, raw[k]);
+        sensor_publish(&kegs[k].sensors.weight, filtered);
+        if (storesOpen) {
+            store_append(&weightStore, (uint16_t) k, filtered, (int32_t) value,
+                         history_latest(&kegs[k].weightHistory)->rejected ? STORE_REJECTED : 0);
+        }
+    }
+}
+
+// commits the samples appended since the last sync to disk.
+// period = 10 s, batching keeps the SD card writes down
+static void syncStores(struct event_source *source) {
+    (void) source;
+    store_sync(&weightStore);
+    store_sync(&temperatureStore);
+}
+
+// CLOCK_REALTIME ns of a CLOCK_MONOTONIC sample time, given both clocks now
+static int64_t realtimeOf(const struct timespec *sample, const struct timespec *monotonic, const struct timespec *realtime) {
+    int64_t age = (int64_t) (monotonic->tv_sec - sample->tv_sec) * 1000000000LL + (monotonic->tv_nsec - sample->tv_nsec);
+    return (int64_t) realtime->tv_sec * 1000000000LL + realtime->tv_nsec - age;
+}
+
+// copies every keg's readings into the shared memory status.
+// period = 1 s
+static void publishStatus(struct event_source *source) {
+    struct timespec monotonic, realtime;
+
+    (void) source;
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    for (int32_t k = 0; k < numKegs; k++) {
+        struct status_values values = {0};
+        struct sensor_snapshot snapshot;
+
+        sensor_snapshot(&kegs[k].sensors, &snapshot);
+        values.update_time_ns = (int64_t) realtime.tv_sec * 1000000000LL + realtime.tv_nsec;
+        if (snapshot.weight.sequence == 0) {
+            values.health |= STATUS_WEIGHT_MISSING;
+        } else {
+            values.weight = convertToGrams(&kegs[k], &snapshot.weight);
+            values.percent = convertToPercentage(&kegs[k], &snapshot.weight);
+            values.weight_time_ns = realtimeOf(&snapshot.weight.time, &monotonic, &realtime);
+            if (values.update_time_ns - values.weight_time_ns > STATUS_STALE_PERIODS * WEIGHT_PERIOD_MS * 1000000LL) {
+                values.health |= STATUS_WEIGHT_STALE;
+            }
+        }
+        if (snapshot.temperature.sequence == 0) {
+            values.health |= STATUS_TEMPERATURE_MISSING;
+        } else {
+            values.temperature = snapshot.temperature.value;
+            values.temperature_time_ns = realtimeOf(&snapshot.temperature.time, &monotonic, &realtime);
+            if (values.update_time_ns - values.temperature_time_ns > STATUS_STALE_PERIODS * TEMPERATURE_PERIOD_MS * 1000000LL) {
+                values.health |= STATUS_TEMPERATURE_STALE;
+            }
+        }
+        status_publish(&statusMap, (uint32_t) k, &values);
+    }
+}
+
+// keeps the newest accepted record of every keg
+static void resumeRecord(const struct store_record *record, void *arg) {
+    struct store_record *latest = arg;
+
+    if (record->keg < MAX_KEGS && !(record->flags & STORE_REJECTED)) {
+        latest[record->keg] = *record;
+    }
+}
+
+// seeds the filters and the display with the last stored readings so the
+// screen shows real values right after a restart. runs before the tasks start
+static void resumeHistory() {
+    struct store_record weights[MAX_KEGS] = {0};
+    struct store_record temperature[MAX_KEGS] = {0};
+    struct timespec realtime, now;
+    int64_t to_ns;
+
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    to_ns = (int64_t) realtime.tv_sec * 1000000000LL + realtime.tv_nsec;
+    store_scan(&weightStore, to_ns - STORE_RESUME_NS, to_ns, resumeRecord, weights);
+    store_scan(&temperatureStore, to_ns - STORE_RESUME_NS, to_ns, resumeRecord, temperature);
+
+    for (int32_t k = 0; k < numKegs; k++) {
+        int32_t p = kegs[k].probe;
+
+        if (weights[k].time_ns != 0) {
+            sensor_publish(&kegs[k].sensors.weight, history_push(&kegs[k].weightHistory, weights[k].value, &now));
+        }
+        if (temperature[k].time_ns != 0) {
+            sensor_publish(&kegs[k].sensors.temperature, temperature[k].value);
+            // kegs sharing a probe seed its filter once
+            if (p >= 0 && probes[p].history.count == 0) {
+                history_push(&probes[p].history, temperature[k].value, &now);
+            }
+        }
+    }
 }
 
-// code used by the display_device thread to update the values shown on the LCD 
+// lays out the next page of a screen and queues it on its LCD.
+// one keg gets its values and a full width fill bar under them. with
+// several kegs each refresh shows the next ones, one per line with a bar
+// after the values, and kegs that need more than one page get an overview
+// of all fill levels as vertical bars after the last one.
+// every line is exactly cols cells so lcd_draw() wraps it
+static void drawScreen(struct screen_t *screen) {
+    int32_t cols = screen->cols;
+    int32_t first = screen->keg >= 0 ? screen->keg : 0;
+    int32_t count = screen->keg >= 0 ? 1 : numKegs;
+    int32_t pages = (count + screen->rows - 1) / screen->rows;
+    char lines[LCD_MAX_ROWS * LCD_MAX_COLS + 1];
+
+    memset(lines, ' ', screen->rows * cols);
+    lines[screen->rows * cols] = '\0';
+    if (screen->page == pages) {
+        // one column per keg, spaced out when there is room
+        int32_t step = count * 2 <= cols ? 2 : 1;
+
+        for (int32_t k = 0; k < count && k < cols; k++) {
+            struct sensor_snapshot snapshot;
+
+            sensor_snapshot(&kegs[k].sensors, &snapshot);
+            lcd_vbar(&lines[k * step], &lines[cols + k * step], (int32_t) (convertToPercentage(&kegs[k], &snapshot.weight) + 0.5));
+        }
+    }
+    for (int32_t row = 0; row < screen->rows && screen->page < pages; row++) {
+        int32_t k = first + screen->page * screen->rows + row;
+        double localTemp=-1,localWeight=-1;
+        struct sensor_snapshot snapshot;
+        char text[LCD_MAX_COLS + 1];
+        int32_t used;
+
+        if (k >= first + count) {
+            break;
+        }
+        sensor_snapshot(&kegs[k].sensors, &snapshot);
+        localWeight=convertToPercentage(&kegs[k], &snapshot.weight);
+        if(snapshot.temperature.sequence!=0){
+            localTemp= snapshot.temperature.value;
+        }
+
+        if (count == 1) {
+            snprintf(text, cols + 1, "Temp:%.00fC Wgt:%.00f%%", localTemp, localWeight);
+            memcpy(lines, text, strlen(text));
+            if (screen->rows > 1) {
+                lcd_hbar(&lines[cols], cols, (int32_t) (localWeight + 0.5));
+            }
+            break;
+        }
+        used = snprintf(text, cols + 1, "K%d %.00fC %.00f%% ", k + 1, localTemp, localWeight);
+        used = used > cols ? cols : used;
+        memcpy(&lines[row * cols], text, used);
+        lcd_hbar(&lines[row * cols + used], cols - used, (int32_t) (localWeight + 0.5));
+    }
+    // the overview is only worth a page when the kegs don't fit on one
+    if (screen->page + 1 < pages || (screen->page + 1 == pages && pages > 1 && screen->rows > 1)) {
+        screen->page++;
+    } else {
+        screen->page = 0;
+    }
+
+    lcd_draw(screen->lcd, lines);
+}
+
+// code used by the display source to update the values shown on the LCDs 
 // Terminal display must be updated every 3 s. 
-void *modifyLED(void *arg) {
-    pthread_t tid = pthread_self();
-    printf("Process ID of modifyLED Thread is : %lu\n", tid);
-    double localTemp=-1,localWeight=-1;
-    char *lines[100];
-    i2c_init();
-    while (true) {
-        
-        usleep(3000000);    
-
-        localWeight=convertToPercentage();
-        
-        pthread_mutex_lock(&temperature_mutex);
-           localTemp= current_temperature;
-        pthread_mutex_unlock(&temperature_mutex);
-
-        char *lines = (char *) malloc(100 * sizeof(char));
-        snprintf(lines, 100, "Temp:%.00fC Wgt:%.00f%%", localTemp, localWeight);
-
-         // printf("lines- %s",lines);
-         int32_t flag= i2c_msg(lines);
-        //printf("Temperature- %.0lf , Quantity- %.0lf\% \n",localTemp,localWeight);
-
-        // added
-       free(lines);
-    }
-    i2c_stop();
-    printf("Exiting THREAD modifyLED\n\n");
-    return NULL;
-}
\ No newline at end of file
+// every screen is queued first and they all go out in one flush, so each
+// refresh is one combined transfer on the bus however many screens there are
+static void modifyLED(struct event_source *source) {
+    (void) source;
+    for (int32_t s = 0; s < numScreens; s++) {
+        drawScreen(&screens[s]);
+    }
+    lcd_flush();
+}
+
+// SIGINT: stops the event loop, start_system() then shuts down
+// SIGUSR1: prints the wake up and execution time histograms of every task
+// SIGUSR2: writes the binary trace for trace_decode
+static void handleSignals(struct event_source *source) {
+    struct signalfd_siginfo info;
+
+    while (read(source->fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGINT) {
+            event_loop_stop(&loop);
+        } else if (info.ssi_signo == SIGUSR1) {
+            latency_dump(stdout);
+        } else if (trace_dump(config.trace_file) == 0) {
+            printf("Trace written to %s\n", config.trace_file);
+        }
+    }
+}
@@ -0,0 +1,451 @@
+// Benchmark of the sensor to display pipeline against the simulated backend.
+// Each stage runs many times and reports latency percentiles plus the I/O it
+// caused per operation, as a table and as JSON so builds can be compared.
+//
+// usage: bench [-n iterations] [-k kegs] [-o results.json]
+//
+// stages:
+//   lcd_refresh_steady  lcd_show() when one digit changed (framebuffer diff)
+//   lcd_refresh_full    lcd_show() after a clear, every cell rewritten
+//   lcd_bars            two keg lines with fill bars, one digit changed; the
+//                       glyphs stay in CGRAM so only DDRAM cells are sent
+//   lcd_multi           a 20x4 and three 16x2 panels on one bus each change
+//                       a digit, sent as one combined transfer
+//   sysfs_read          readGPIO() board path: pread + parse of a sysfs value
+//   hx711_read          shared clock-out of every keg (RAM stands in for GPIO1)
+//   filter_publish      history_push + sensor_publish per keg
+//   calib_convert       counts to grams to percent per keg, 4 point table
+//   sample_to_pixel     sample read to LCD bytes on the bus, whole pipeline
+//   series_encode       compress one hour of one keg's HX711 counts
+//   series_decode       decompress that hour again
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "lcd.h"
+#include "hal.h"
+#include "hal_sim.h"
+#include "hx711.h"
+#include "history.h"
+#include "sensor_state.h"
+#include "sysfs_node.h"
+#include "series.h"
+#include "store.h"
+#include "calib.h"
+
+#define BENCH_MAX_KEGS HX711_MAX_CELLS
+#define SERIES_BLOCK_SAMPLES 3600       // one hour of one keg at 1 Hz
+#define SERIES_DRAIN_SECONDS (7 * 86400.0)
+// sample noise of a load cell on an HX711 at 10 SPS and gain 128, about 17
+// noise free bits. the simulated sensors are noisier to exercise the filters
+#define SERIES_NOISE_COUNTS 64
+
+struct bench_result {
+    const char *name;
+    uint64_t p50_ns, p90_ns, p99_ns, max_ns;
+    double syscalls_per_op;     // bus writes or reads issued per operation
+    double bytes_per_op;        // I2C or encoded bytes per operation, 0 for neither
+};
+
+static uint64_t *latencies;
+static int32_t iterations = 1000;
+static int32_t numKegs = 1;
+static struct bench_result results[16];
+static size_t numResults = 0;
+static double seriesBytesPerSample = 0;
+// the 16x2 the single panel stages draw on
+static struct lcd_display *panel;
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ull + (uint64_t) t.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// sorts the collected latencies into a result entry
+static struct bench_result *record(const char *name, double syscalls, double bytes) {
+    struct bench_result *r = &results[numResults++];
+
+    qsort(latencies, (size_t) iterations, sizeof(uint64_t), compare_u64);
+    r->name = name;
+    r->p50_ns = latencies[iterations * 50 / 100];
+    r->p90_ns = latencies[iterations * 90 / 100];
+    r->p99_ns = latencies[iterations * 99 / 100];
+    r->max_ns = latencies[iterations - 1];
+    r->syscalls_per_op = syscalls;
+    r->bytes_per_op = bytes;
+    return r;
+}
+
+// the bar display and three taps, all queued before one flush. the
+// syscalls are bus transfers, the bytes those of all four panels
+static void bench_lcd_multi() {
+    struct lcd_display *panels[4];
+    uint64_t transfers, bytes = 0;
+    char text[32];
+
+    panels[0] = lcd_open(I2C_BUS, 0x26, 20, 4);
+    for (int32_t p = 1; p < 4; p++) {
+        panels[p] = lcd_open(I2C_BUS, 0x20 + p, 16, 2);
+    }
+    for (int32_t p = 0; p < 4; p++) {
+        if (panels[p] == NULL) {
+            return;
+        }
+        lcd_draw(panels[p], "Temp:4C Wgt:55%");
+    }
+    lcd_flush();
+    transfers = hal_sim_i2c_transfers();
+    for (int32_t p = 0; p < 4; p++) {
+        hal_sim_lcd_reset_stats(lcd_handle(panels[p]));
+    }
+    for (int32_t i = 0; i < iterations; i++) {
+        snprintf(text, sizeof(text), "Temp:%dC Wgt:55%%", 4 + (i & 1));
+        uint64_t start = now_ns();
+        for (int32_t p = 0; p < 4; p++) {
+            lcd_draw(panels[p], text);
+        }
+        lcd_flush();
+        latencies[i] = now_ns() - start;
+    }
+    for (int32_t p = 0; p < 4; p++) {
+        struct sim_lcd_stats stats;
+
+        hal_sim_lcd_stats(lcd_handle(panels[p]), &stats);
+        bytes += stats.bytes;
+        lcd_close(panels[p]);
+    }
+    record("lcd_multi", (double) (hal_sim_i2c_transfers() - transfers) / iterations, (double) bytes / iterations);
+}
+
+static void bench_lcd() {
+    struct sim_lcd_stats stats;
+    char text[32];
+
+    // steady state: only the temperature digit changes between refreshes
+    lcd_show(panel, "Temp:4C Wgt:55%");
+    hal_sim_lcd_reset_stats(lcd_handle(panel));
+    for (int32_t i = 0; i < iterations; i++) {
+        snprintf(text, sizeof(text), "Temp:%dC Wgt:55%%", 4 + (i & 1));
+        uint64_t start = now_ns();
+        lcd_show(panel, text);
+        latencies[i] = now_ns() - start;
+    }
+    hal_sim_lcd_stats(lcd_handle(panel), &stats);
+    record("lcd_refresh_steady", (double) stats.writes / iterations, (double) stats.bytes / iterations);
+
+    // full redraw: the panel is cleared before every refresh
+    hal_sim_lcd_reset_stats(lcd_handle(panel));
+    for (int32_t i = 0; i < iterations; i++) {
+        lcd_clear(panel);
+        uint64_t start = now_ns();
+        lcd_show(panel, "Temp:4C Wgt:55%");
+        latencies[i] = now_ns() - start;
+    }
+    hal_sim_lcd_stats(lcd_handle(panel), &stats);
+    // the clears are part of the stats: one write of 4 bytes each
+    record("lcd_refresh_full", (double) (stats.writes - iterations) / iterations, (double) (stats.bytes - 4ull * iterations) / iterations);
+
+    // bars as modifyLED() draws them for two kegs, the first refresh loads
+    // the partial glyphs and is left out
+    for (int32_t i = 0; i <= iterations; i++) {
+        char lines[LCD_ROWS * LCD_COLS + 1];
+
+        snprintf(lines, sizeof(lines), "K1 %dC 63%%      K2 5C 18%%      ", 4 + (i & 1));
+        lcd_hbar(&lines[10], LCD_COLS - 10, 63);
+        lcd_hbar(&lines[LCD_COLS + 10], LCD_COLS - 10, 18);
+        if (i == 0) {
+            lcd_show(panel, lines);
+            hal_sim_lcd_reset_stats(lcd_handle(panel));
+            continue;
+        }
+        uint64_t start = now_ns();
+        lcd_show(panel, lines);
+        latencies[i - 1] = now_ns() - start;
+    }
+    hal_sim_lcd_stats(lcd_handle(panel), &stats);
+    record("lcd_bars", (double) stats.writes / iterations, (double) stats.bytes / iterations);
+    bench_lcd_multi();
+}
+
+static void bench_sysfs() {
+    char path[] = "/tmp/bench_temp1_inputXXXXXX";
+    int32_t fd = mkstemp(path);
+    struct sysfs_node node;
+    int64_t value;
+
+    if (fd < 0 || write(fd, "23125\n", 6) != 6) {
+        printf("Error creating %s\n", path);
+        return;
+    }
+    close(fd);
+    sysfs_open(&node, path, O_RDONLY);
+    for (int32_t i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        sysfs_read_int(&node, &value);
+        latencies[i] = now_ns() - start;
+    }
+    sysfs_close(&node);
+    unlink(path);
+    record("sysfs_read", 1, 0);
+}
+
+static void bench_hx711() {
+    static uint32_t registers[BLOCK_SIZE / WORD_SIZE];
+    struct hx711_array cells = {0};
+    uint32_t samples[BENCH_MAX_KEGS];
+
+    // plain memory stands in for the GPIO1 block, the timing comes from the
+    // calibrated PD_SCK delays
+    hx711_calibrate_delay();
+    cells.dev.gpio_addr = registers;
+    cells.dev.setdataout = registers + GPIO_SETDATAOUT / WORD_SIZE;
+    cells.dev.cleardataout = registers + GPIO_CLEARDATAOUT / WORD_SIZE;
+    cells.dev.datain = registers + GPIO_DATAIN / WORD_SIZE;
+    cells.dev.oe = registers + GPIO_OE / WORD_SIZE;
+    cells.dev.sck_bit = 1u << (PD_SCK_PIN - GPIO_BANK_FIRST);
+    cells.dev.gain = HX711_GAIN_A128;
+    cells.dev.event_fd = -1;
+    cells.count = (size_t) numKegs;
+    for (int32_t k = 0; k < numKegs; k++) {
+        cells.dout_shift[k] = (uint8_t) k;
+    }
+
+    for (int32_t i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        hx711_array_read(&cells, samples);
+        latencies[i] = now_ns() - start;
+    }
+    record("hx711_read", 0, 0);
+}
+
+static void bench_filter() {
+    static struct sample_history histories[BENCH_MAX_KEGS];
+    static struct sensor_state states[BENCH_MAX_KEGS];
+    struct timespec t = {0};
+
+    for (int32_t k = 0; k < numKegs; k++) {
+        history_init(&histories[k], 0.3, 80000);
+    }
+    for (int32_t i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        for (int32_t k = 0; k < numKegs; k++) {
+            sensor_publish(&states[k].weight, history_push(&histories[k], 500000 + (i % 7) * 10, &t));
+        }
+        latencies[i] = now_ns() - start;
+    }
+    record("filter_publish", 0, 0);
+}
+
+static void bench_calib() {
+    struct calib_config config = {
+        .tare = 8400, .points = 4,
+        .point = { { 105000, 5000 }, { 210500, 10000 }, { 317000, 15000 }, { 424000, 20000 } },
+        .empty = 13500, .full = 63000,
+    };
+    struct calib_table table;
+    volatile int32_t sink = 0;
+
+    calib_build(&table, &config);
+    for (int32_t i = 0; i < iterations; i++) {
+        uint64_t start = now_ns();
+        for (int32_t k = 0; k < numKegs; k++) {
+            sink += calib_percent(&table, calib_grams(&table, 300000 + (i % 97) * 9000 + k));
+        }
+        latencies[i] = now_ns() - start;
+    }
+    record("calib_convert", 0, 0);
+}
+
+// one sample of every keg from the simulated HX711 to changed cells on the
+// panel: read, filter, publish, snapshot, format and LCD update
+static void bench_pipeline() {
+    static struct sample_history histories[BENCH_MAX_KEGS];
+    static struct sensor_state states[BENCH_MAX_KEGS];
+    const struct sim_script *script = hal_sim_script();
+    // the two point calibration in counts the simulated kegs drain between
+    struct calib_config config = { .empty = (int32_t) script->weight_empty_counts, .full = (int32_t) script->weight_full_counts };
+    struct calib_table table;
+    struct sim_lcd_stats stats;
+    int32_t dout_pins[BENCH_MAX_KEGS] = {0};
+    uint32_t raw[BENCH_MAX_KEGS];
+    char text[100];
+
+    calib_build(&table, &config);
+    hal->weight_open(PD_SCK_PIN, dout_pins, (size_t) numKegs);
+    for (int32_t k = 0; k < numKegs; k++) {
+        history_init(&histories[k], 0.3, 0.1 * (script->weight_full_counts - script->weight_empty_counts));
+    }
+
+    hal_sim_lcd_reset_stats(lcd_handle(panel));
+    for (int32_t i = 0; i < iterations; i++) {
+        struct sensor_snapshot snapshot;
+        struct timespec t;
+        size_t used = 0;
+
+        uint64_t start = now_ns();
+        hal->weight_read(raw);
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        for (int32_t k = 0; k < numKegs; k++) {
+            sensor_publish(&states[k].weight, history_push(&histories[k], HX711_SIGN_EXTEND(raw[k]), &t));
+        }
+        for (int32_t k = 0; k < numKegs && k < LCD_ROWS; k++) {
+            sensor_snapshot(&states[k], &snapshot);
+            int32_t percent = calib_percent(&table, calib_grams(&table, (int32_t) snapshot.weight.value));
+            used += snprintf(text + used, sizeof(text) - used, "K%d %d%% #%d\n", k + 1, percent / 100, i % 10);
+        }
+        lcd_show(panel, text);
+        latencies[i] = now_ns() - start;
+    }
+    hal_sim_lcd_stats(lcd_handle(panel), &stats);
+    record("sample_to_pixel", (double) stats.writes / iterations, (double) stats.bytes / iterations);
+}
+
+// a keg draining over a week, sampled at 1 Hz and encoded an hour at a
+// time, at the second resolution of the store archives
+static void bench_series() {
+    const struct sim_script *script = hal_sim_script();
+    static int64_t times[SERIES_BLOCK_SAMPLES];
+    static int32_t values[SERIES_BLOCK_SAMPLES];
+    uint8_t *buf = malloc(SERIES_BLOCK_SAMPLES * SERIES_MAX_SAMPLE_BYTES);
+    struct series_encoder enc;
+    struct series_decoder dec;
+    unsigned int seed = 1;
+    uint64_t bytes = 0;
+
+    if (buf == NULL) {
+        return;
+    }
+    for (int32_t i = 0; i < iterations; i++) {
+        for (int32_t s = 0; s < SERIES_BLOCK_SAMPLES; s++) {
+            double second = (double) i * SERIES_BLOCK_SAMPLES + s;
+            double drained = fmod(second / SERIES_DRAIN_SECONDS, 1.0);
+
+            times[s] = (int64_t) second;
+            values[s] = (int32_t) (script->weight_full_counts - drained * (script->weight_full_counts - script->weight_empty_counts) +
+                                   SERIES_NOISE_COUNTS * (2.0 * rand_r(&seed) / RAND_MAX - 1.0));
+        }
+        uint64_t start = now_ns();
+        series_encoder_init(&enc, buf, SERIES_BLOCK_SAMPLES * SERIES_MAX_SAMPLE_BYTES);
+        for (int32_t s = 0; s < SERIES_BLOCK_SAMPLES; s++) {
+            series_encode(&enc, times[s], values[s]);
+        }
+        latencies[i] = now_ns() - start;
+        bytes += series_encoder_bytes(&enc);
+    }
+    record("series_encode", 0, (double) bytes / iterations);
+    seriesBytesPerSample = (double) bytes / iterations / SERIES_BLOCK_SAMPLES;
+
+    // decodes the last hour, checking it round trips
+    for (int32_t i = 0; i < iterations; i++) {
+        int64_t time;
+        int32_t value;
+        int32_t s = 0;
+
+        uint64_t start = now_ns();
+        series_decoder_init(&dec, buf, series_encoder_bytes(&enc), enc.count);
+        while (series_decode(&dec, &time, &value) == 0) {
+            if (time != times[s] || value != values[s]) {
+                printf("Error: series sample %d decoded as %lld %d\n", s, (long long) time, value);
+                break;
+            }
+            s++;
+        }
+        latencies[i] = now_ns() - start;
+    }
+    record("series_decode", 0, (double) series_encoder_bytes(&enc));
+    free(buf);
+}
+
+static void print_results(FILE *json) {
+    printf("%-20s %10s %10s %10s %10s %9s %9s\n", "stage", "p50 us", "p90 us", "p99 us", "max us", "sys/op", "B/op");
+    for (size_t i = 0; i < numResults; i++) {
+        const struct bench_result *r = &results[i];
+        printf("%-20s %10.2f %10.2f %10.2f %10.2f %9.2f %9.1f\n", r->name,
+               r->p50_ns / 1e3, r->p90_ns / 1e3, r->p99_ns / 1e3, r->max_ns / 1e3,
+               r->syscalls_per_op, r->bytes_per_op);
+    }
+    // the last result is series_decode, one hour block per operation
+    double decodeRate = SERIES_BLOCK_SAMPLES / (results[numResults - 1].p50_ns / 1e9);
+    double yearBytes = seriesBytesPerSample * 365 * 86400.0 * BENCH_MAX_KEGS;
+    printf("series: %.2f bytes/sample (%zu stored), decode %.1f M samples/s, a year of %d kegs at 1 Hz is %.0f MiB\n",
+           seriesBytesPerSample, sizeof(struct store_record), decodeRate / 1e6, BENCH_MAX_KEGS, yearBytes / (1024 * 1024));
+    if (json == NULL) {
+        return;
+    }
+    fprintf(json, "{\n  \"iterations\": %d,\n  \"kegs\": %d,\n  \"stages\": [\n", iterations, numKegs);
+    for (size_t i = 0; i < numResults; i++) {
+        const struct bench_result *r = &results[i];
+        fprintf(json, "    {\"name\": \"%s\", \"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, "
+                      "\"syscalls_per_op\": %.3f, \"bytes_per_op\": %.1f}%s\n",
+                r->name, (unsigned long long) r->p50_ns, (unsigned long long) r->p90_ns,
+                (unsigned long long) r->p99_ns, (unsigned long long) r->max_ns,
+                r->syscalls_per_op, r->bytes_per_op, i + 1 < numResults ? "," : "");
+    }
+    fprintf(json, "  ],\n  \"series\": {\"bytes_per_sample\": %.3f, \"decode_samples_per_s\": %.0f, \"year_bytes_%d_kegs\": %.0f}\n}\n",
+            seriesBytesPerSample, decodeRate, BENCH_MAX_KEGS, yearBytes);
+}
+
+int main(int argc, char *argv[]) {
+    struct sim_script script = *hal_sim_script();
+    const char *output = NULL;
+    FILE *json = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:k:o:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            iterations = atoi(optarg);
+        } else if (opt == 'k' && atoi(optarg) >= 1 && atoi(optarg) <= BENCH_MAX_KEGS) {
+            numKegs = atoi(optarg);
+        } else if (opt == 'o') {
+            output = optarg;
+        } else {
+            printf("usage: %s [-n iterations] [-k kegs 1-%d] [-o results.json]\n", argv[0], BENCH_MAX_KEGS);
+            return 1;
+        }
+    }
+
+    latencies = calloc((size_t) iterations, sizeof(uint64_t));
+    if (latencies == NULL) {
+        return 1;
+    }
+
+    // no waiting on simulated conversions, only the code path is measured
+    script.conversion_us = 0;
+    script.spike_every = 0;
+    hal_sim_configure(&script);
+    hal = &hal_sim;
+    panel = lcd_open(I2C_BUS, I2C_ADDR, LCD_COLS, LCD_ROWS);
+    if (panel == NULL) {
+        return 1;
+    }
+    lcd_flush();
+
+    bench_lcd();
+    bench_sysfs();
+    bench_hx711();
+    bench_filter();
+    bench_calib();
+    bench_pipeline();
+    bench_series();
+
+    if (output != NULL && (json = fopen(output, "w")) == NULL) {
+        printf("Error: could not open %s\n", output);
+    }
+    print_results(json);
+    if (json != NULL) {
+        fclose(json);
+    }
+    free(latencies);
+    return 0;
+}
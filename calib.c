@@ -0,0 +1,87 @@
+// Load cell calibration: HX711 counts to grams and keg percentage.
+// A cell is described by its tare and a few reference loads; between them
+// the reading is interpolated linearly, beyond the last one the last
+// segment is extended. calib_build() turns the captured config into slopes
+// and a percent scale in fixed point once, after that every conversion is
+// integer math only and cheap enough to run on every sample of every keg.
+
+#include <string.h>
+#include "calib.h"
+
+// half an LSB of the Q24 results, added before shifting so they round
+#define CALIB_ROUND (1LL << (CALIB_SLOPE_SHIFT - 1))
+
+// precomputes table from config. returns 0 on success, -1 when the points
+// don't ascend in both counts and grams or the full keg isn't heavier than
+// the empty one
+int32_t calib_build(struct calib_table *table, const struct calib_config *config) {
+    uint32_t n = 1;
+
+    if (config->points > CALIB_MAX_POINTS || config->full <= config->empty) {
+        return -1;
+    }
+    memset(table, 0, sizeof(*table));
+    table->tare = config->tare;
+    for (uint32_t i = 0; i < config->points; i++) {
+        if (config->point[i].raw <= table->raw[n - 1] || config->point[i].grams <= table->grams[n - 1]) {
+            return -1;
+        }
+        table->raw[n] = config->point[i].raw;
+        table->grams[n] = config->point[i].grams;
+        n++;
+    }
+    if (n == 1) {
+        // no reference loads, one count is one "gram"
+        table->raw[n] = 1;
+        table->grams[n] = 1;
+        n++;
+    }
+    table->points = n;
+    for (uint32_t i = 0; i + 1 < n; i++) {
+        int64_t grams = (int64_t) table->grams[i + 1] - table->grams[i];
+        int64_t counts = (int64_t) table->raw[i + 1] - table->raw[i];
+
+        table->slope[i] = ((grams << CALIB_SLOPE_SHIFT) + counts / 2) / counts;
+        if (table->slope[i] == 0) {
+            return -1;
+        }
+    }
+    table->empty = config->empty;
+    table->full = config->full;
+    int64_t range = (int64_t) config->full - config->empty;
+    table->percent_scale = (((int64_t) CALIB_PERCENT_ONE << CALIB_SLOPE_SHIFT) + range / 2) / range;
+    return 0;
+}
+
+// grams on the cell for a raw reading
+int32_t calib_grams(const struct calib_table *table, int32_t raw) {
+    int32_t counts = raw - table->tare;
+    uint32_t i = 0;
+
+    // a handful of points, a linear search beats a binary one
+    while (i + 2 < table->points && counts >= table->raw[i + 1]) {
+        i++;
+    }
+    return table->grams[i] + (int32_t) (((int64_t) (counts - table->raw[i]) * table->slope[i] + CALIB_ROUND) >> CALIB_SLOPE_SHIFT);
+}
+
+// raw reading of a load, the inverse of calib_grams(). only used to size
+// limits in counts, so it may divide
+int32_t calib_raw(const struct calib_table *table, int32_t grams) {
+    uint32_t i = 0;
+
+    while (i + 2 < table->points && grams >= table->grams[i + 1]) {
+        i++;
+    }
+    return table->tare + table->raw[i] + (int32_t) ((int64_t) (grams - table->grams[i]) * (1LL << CALIB_SLOPE_SHIFT) / table->slope[i]);
+}
+
+// how full the keg is, in hundredths of a percent from 0 to CALIB_PERCENT_ONE
+int32_t calib_percent(const struct calib_table *table, int32_t grams) {
+    int64_t percent = ((int64_t) (grams - table->empty) * table->percent_scale + CALIB_ROUND) >> CALIB_SLOPE_SHIFT;
+
+    if (percent < 0) {
+        return 0;
+    }
+    return percent > CALIB_PERCENT_ONE ? CALIB_PERCENT_ONE : (int32_t) percent;
+}
@@ -0,0 +1,47 @@
+#ifndef CALIB_H
+#define CALIB_H
+
+#include <stdint.h>
+
+#define CALIB_MAX_POINTS 8
+// slopes are grams per count in Q24, enough for 2^7 g per count and a 25 bit
+// count difference in an int64_t product
+#define CALIB_SLOPE_SHIFT 24
+#define CALIB_PERCENT_ONE 10000     // calib_percent() is in hundredths of a percent
+
+// a known load on a cell: its reading in counts above the tare, and grams
+struct calib_point {
+    int32_t raw;
+    int32_t grams;
+};
+
+// what is captured once per keg and stored. the points are relative to the
+// tare so re-taring a drifted cell keeps them. without points grams are raw
+// counts above the tare, which keeps the old empty/full count calibration
+struct calib_config {
+    int32_t tare;                   // raw HX711 counts with nothing on the cell
+    uint32_t points;                // reference loads, ascending raw
+    struct calib_point point[CALIB_MAX_POINTS];
+    int32_t empty;                  // grams of the empty keg
+    int32_t full;                   // grams of the full keg
+};
+
+// the config with the slope of every segment and the percent scale
+// precomputed, so a conversion is a short search, two multiplies and shifts
+struct calib_table {
+    int32_t tare;
+    uint32_t points;                // including the tare as (0, 0)
+    int32_t raw[CALIB_MAX_POINTS + 1];
+    int32_t grams[CALIB_MAX_POINTS + 1];
+    int64_t slope[CALIB_MAX_POINTS + 1];    // Q24 grams per count from point i to i + 1
+    int32_t empty;
+    int32_t full;
+    int64_t percent_scale;          // Q24 hundredths of a percent per gram
+};
+
+int32_t calib_build(struct calib_table *table, const struct calib_config *config);
+int32_t calib_grams(const struct calib_table *table, int32_t raw);
+int32_t calib_raw(const struct calib_table *table, int32_t grams);
+int32_t calib_percent(const struct calib_table *table, int32_t grams);
+
+#endif
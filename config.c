@@ -0,0 +1,292 @@
+// Startup configuration of the monitor.
+// Replaces the console prompts, so a unit comes back on its own after a
+// power cut. The file is "key = value" lines, # starts a comment:
+//
+//   kegs = 2
+//   realtime = yes
+//   sck = 48                  PD_SCK shared by every HX711
+//   w1 = 28-2b46d446b48a      one probe shown for every keg without its own
+//   resolution = 11           DS18B20 bits of every probe, 9 to 12
+//   keg1.dout = 49
+//   keg1.tare = 8400          raw HX711 counts with nothing on the cell
+//   keg1.point = 210000:10000 counts above the tare : grams, one per
+//   keg1.point = 425000:20000   reference load, at most CALIB_MAX_POINTS
+//   keg1.empty = 13500        grams of the empty and the full keg
+//   keg1.full = 63000
+//   keg2.dout = 50
+//   keg2.w1 = 28-0316a279c3ff
+//   display1.size = 20x4      the bar display, every keg
+//   display2.addr = 0x21      a 16x2 at keg 1's tap on the same bus
+//   display2.keg = 1
+//
+// sck and dout are GPIO numbers on GPIO1, 32 to 63. kegs without a w1 id
+// get the probes found on the bus in id order. a keg without points takes
+// empty and full as counts above the tare. beerStatus -C captures the
+// calibration and prints the lines for this file.
+// plus sim, store_dir, trace_file and query_socket. Any key can also be
+// given on the command line with -o key=value, which wins over the file.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "config.h"
+#include "hx711.h"
+#include "query.h"
+#include "hal.h"
+
+// the original wiring: one keg on GPIO 48/49 and a 16x2 LCD at 0x27 on
+// /dev/i2c-2. probes are discovered
+void config_defaults(struct monitor_config *config) {
+    memset(config, 0, sizeof(*config));
+    config->kegs = 1;
+    snprintf(config->store_dir, sizeof(config->store_dir), "%s", "/var/lib/kegmon");
+    snprintf(config->trace_file, sizeof(config->trace_file), "%s", "/tmp/kegmon.trace");
+    snprintf(config->query_socket, sizeof(config->query_socket), "%s", QUERY_SOCKET_PATH);
+    for (int32_t k = 0; k < CONFIG_MAX_KEGS; k++) {
+        struct keg_config *keg = &config->keg[k];
+
+        keg->sck = PD_SCK_PIN;
+        keg->dout = k == 0 ? DOUT_PIN : -1;
+        keg->resolution = W1_MAX_RESOLUTION;
+    }
+    for (int32_t d = 0; d < CONFIG_MAX_DISPLAYS; d++) {
+        struct display_config *display = &config->display[d];
+
+        snprintf(display->bus, sizeof(display->bus), "%s", "/dev/i2c-2");
+        display->addr = d == 0 ? 0x27 : -1;
+        display->cols = 16;
+        display->rows = 2;
+    }
+}
+
+static int32_t parse_bool(const char *value, bool *out) {
+    if (strcmp(value, "yes") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0) {
+        *out = true;
+    } else if (strcmp(value, "no") == 0 || strcmp(value, "false") == 0 || strcmp(value, "0") == 0) {
+        *out = false;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int32_t parse_number(const char *value, double *out) {
+    char *end;
+
+    errno = 0;
+    *out = strtod(value, &end);
+    return errno != 0 || end == value || *end != '\0' ? -1 : 0;
+}
+
+static int32_t parse_gpio(const char *value, int32_t *out) {
+    double number;
+
+    if (parse_number(value, &number) != 0 || number < 0 || number != (int32_t) number) {
+        return -1;
+    }
+    *out = (int32_t) number;
+    return 0;
+}
+
+static int32_t parse_int(const char *value, int32_t *out) {
+    double number;
+
+    if (parse_number(value, &number) != 0 || number < INT32_MIN || number > INT32_MAX || number != (int32_t) number) {
+        return -1;
+    }
+    *out = (int32_t) number;
+    return 0;
+}
+
+// "counts:grams", appended to the keg's reference points
+static int32_t parse_point(const char *value, struct calib_config *calib) {
+    struct calib_point *point = &calib->point[calib->points];
+    char extra;
+
+    if (calib->points >= CALIB_MAX_POINTS ||
+        sscanf(value, "%d:%d%c", &point->raw, &point->grams, &extra) != 2) {
+        return -1;
+    }
+    calib->points++;
+    return 0;
+}
+
+static int32_t copy_string(const char *value, char *out, size_t size) {
+    if (strlen(value) >= size) {
+        return -1;
+    }
+    snprintf(out, size, "%s", value);
+    return 0;
+}
+
+// a setting of one keg, key is what follows "kegN."
+static int32_t config_set_keg(struct keg_config *keg, const char *key, const char *value) {
+    int32_t result = -1;
+
+    if (strcmp(key, "sck") == 0) {
+        result = parse_gpio(value, &keg->sck) != 0 || !GPIO_IN_BANK(keg->sck) ? -1 : 0;
+    } else if (strcmp(key, "dout") == 0) {
+        result = parse_gpio(value, &keg->dout) != 0 || !GPIO_IN_BANK(keg->dout) ? -1 : 0;
+    } else if (strcmp(key, "w1") == 0) {
+        result = copy_string(value, keg->w1_id, sizeof(keg->w1_id));
+    } else if (strcmp(key, "resolution") == 0) {
+        result = parse_int(value, &keg->resolution);
+        if (keg->resolution < W1_MIN_RESOLUTION || keg->resolution > W1_MAX_RESOLUTION) {
+            keg->resolution = W1_MAX_RESOLUTION;
+            result = -1;
+        }
+    } else if (strcmp(key, "tare") == 0) {
+        result = parse_int(value, &keg->calib.tare);
+    } else if (strcmp(key, "point") == 0) {
+        result = parse_point(value, &keg->calib);
+    } else if (strcmp(key, "empty") == 0) {
+        result = parse_int(value, &keg->calib.empty);
+        keg->has_empty = result == 0;
+    } else if (strcmp(key, "full") == 0) {
+        result = parse_int(value, &keg->calib.full);
+        keg->has_full = result == 0;
+    }
+    keg->calibrated = keg->has_empty && keg->has_full;
+    return result;
+}
+
+// a setting of one display, key is what follows "displayN."
+static int32_t config_set_display(struct display_config *display, const char *key, const char *value) {
+    char extra;
+
+    if (strcmp(key, "bus") == 0) {
+        return copy_string(value, display->bus, sizeof(display->bus));
+    }
+    if (strcmp(key, "addr") == 0) {
+        // strtod takes 0x27 as well as 39
+        if (strcmp(value, "none") == 0) {
+            display->addr = -1;
+            return 0;
+        }
+        return parse_gpio(value, &display->addr) != 0 || display->addr > 0x7F ? -1 : 0;
+    }
+    if (strcmp(key, "size") == 0) {
+        if (sscanf(value, "%dx%d%c", &display->cols, &display->rows, &extra) != 2 || display->cols < 1 || display->rows < 1) {
+            display->cols = 16;
+            display->rows = 2;
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(key, "keg") == 0) {
+        return parse_gpio(value, &display->keg) != 0 || display->keg > CONFIG_MAX_KEGS ? -1 : 0;
+    }
+    return -1;
+}
+
+// applies one setting. returns 0 on success, -1 for an unknown key or a
+// value that doesn't fit it
+int32_t config_set(struct monitor_config *config, const char *key, const char *value) {
+    double number;
+    int32_t keg;
+    int32_t display;
+    int32_t used = 0;
+
+    if (strcmp(key, "kegs") == 0) {
+        if (parse_number(value, &number) != 0 || number < 1 || number > CONFIG_MAX_KEGS || number != (int32_t) number) {
+            return -1;
+        }
+        config->kegs = (int32_t) number;
+        return 0;
+    }
+    if (strcmp(key, "realtime") == 0) {
+        return parse_bool(value, &config->realtime);
+    }
+    if (strcmp(key, "sim") == 0) {
+        return parse_bool(value, &config->sim);
+    }
+    if (strcmp(key, "store_dir") == 0) {
+        return copy_string(value, config->store_dir, sizeof(config->store_dir));
+    }
+    if (strcmp(key, "trace_file") == 0) {
+        return copy_string(value, config->trace_file, sizeof(config->trace_file));
+    }
+    if (strcmp(key, "query_socket") == 0) {
+        return copy_string(value, config->query_socket, sizeof(config->query_socket));
+    }
+    // sck, w1 and resolution without a keg apply to every keg
+    if (strcmp(key, "sck") == 0 || strcmp(key, "w1") == 0 || strcmp(key, "resolution") == 0) {
+        for (keg = 0; keg < CONFIG_MAX_KEGS; keg++) {
+            if (config_set_keg(&config->keg[keg], key, value) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+    if (sscanf(key, "keg%d.%n", &keg, &used) == 1 && used > 0 && keg >= 1 && keg <= CONFIG_MAX_KEGS) {
+        return config_set_keg(&config->keg[keg - 1], key + used, value);
+    }
+    if (sscanf(key, "display%d.%n", &display, &used) == 1 && used > 0 && display >= 1 && display <= CONFIG_MAX_DISPLAYS) {
+        return config_set_display(&config->display[display - 1], key + used, value);
+    }
+    return -1;
+}
+
+// strips leading and trailing white space in place
+static char *trim(char *s) {
+    char *end;
+
+    while (isspace((unsigned char) *s)) {
+        s++;
+    }
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    return s;
+}
+
+// applies a "key=value" assignment, as given with -o
+int32_t config_override(struct monitor_config *config, const char *assignment) {
+    char line[2 * CONFIG_VALUE_SIZE];
+    char *equals;
+
+    snprintf(line, sizeof(line), "%s", assignment);
+    equals = strchr(line, '=');
+    if (equals == NULL) {
+        return -1;
+    }
+    *equals = '\0';
+    return config_set(config, trim(line), trim(equals + 1));
+}
+
+// reads the settings of path over what config holds.
+// returns 0 on success, the errno of fopen when path can't be opened and
+// -1 when any line is invalid; every bad line is reported
+int32_t config_load(struct monitor_config *config, const char *path) {
+    char line[2 * CONFIG_VALUE_SIZE];
+    int32_t number = 0;
+    int32_t result = 0;
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        return errno;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *comment = strchr(line, '#');
+        char *content;
+
+        number++;
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        content = trim(line);
+        if (*content == '\0') {
+            continue;
+        }
+        if (config_override(config, content) != 0) {
+            printf("Error: %s line %d: invalid setting \"%s\"\n", path, number, content);
+            result = -1;
+        }
+    }
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,53 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "calib.h"
+#include "hal.h"
+
+#define CONFIG_PATH "/etc/kegmon.conf"
+#define CONFIG_MAX_KEGS 16
+#define CONFIG_MAX_DISPLAYS 8
+#define CONFIG_VALUE_SIZE 128
+
+// one keg: the HX711 wiring, its 1-wire probe and the calibration
+struct keg_config {
+    int32_t sck;                        // HX711 PD_SCK GPIO, shared by all kegs
+    int32_t dout;                       // HX711 DOUT GPIO
+    char w1_id[W1_ID_SIZE];             // DS18B20 id, e.g. 28-2b46d446b48a, "" to discover
+    int32_t resolution;                 // DS18B20 bits, 9 (94 ms) to 12 (750 ms)
+    struct calib_config calib;          // tare, reference points, empty and full keg
+    bool has_empty;
+    bool has_full;
+    bool calibrated;                    // empty and full were both given
+};
+
+// one LCD: where it is on the I2C bus, its size and which kegs it shows
+struct display_config {
+    char bus[CONFIG_VALUE_SIZE];        // i2c-dev adapter, e.g. /dev/i2c-2
+    int32_t addr;                       // PCF8574 address, -1 for no display
+    int32_t cols;                       // 16x2 or 20x4
+    int32_t rows;
+    int32_t keg;                        // keg shown, 0 for all of them
+};
+
+// everything needed to start without anyone at a console. filled from
+// the defaults, then the config file, then the command line
+struct monitor_config {
+    int32_t kegs;
+    bool realtime;
+    bool sim;
+    char store_dir[CONFIG_VALUE_SIZE];
+    char trace_file[CONFIG_VALUE_SIZE];
+    char query_socket[CONFIG_VALUE_SIZE];
+    struct keg_config keg[CONFIG_MAX_KEGS];
+    struct display_config display[CONFIG_MAX_DISPLAYS];
+};
+
+void config_defaults(struct monitor_config *config);
+int32_t config_load(struct monitor_config *config, const char *path);
+int32_t config_set(struct monitor_config *config, const char *key, const char *value);
+int32_t config_override(struct monitor_config *config, const char *assignment);
+
+#endif
@@ -0,0 +1,181 @@
+// Single threaded event loop multiplexing every sensor of the monitor.
+// Each source is either a timerfd armed with an absolute, drift free period
+// or an fd supplied by the caller (GPIO edge events, sockets), and all of
+// them are waited on with one epoll_wait. Adding a keg adds sources, not
+// threads.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "event_loop.h"
+
+static int32_t event_loop_register(struct event_loop *loop, struct event_source *source, uint32_t events);
+static void event_loop_dispatch(struct event_source *source);
+
+static void timespec_add_ms(struct timespec *t, uint64_t ms) {
+    t->tv_sec += ms / 1000;
+    t->tv_nsec += (long) (ms % 1000) * 1000000L;
+    if (t->tv_nsec >= 1000000000L) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+// nanoseconds from start to end, 0 when end is earlier
+static uint64_t timespec_diff_ns(const struct timespec *start, const struct timespec *end) {
+    int64_t ns = (int64_t) (end->tv_sec - start->tv_sec) * 1000000000LL + (end->tv_nsec - start->tv_nsec);
+    return ns > 0 ? (uint64_t) ns : 0;
+}
+
+// returns 0 on success, otherwise the errno of epoll_create1
+int32_t event_loop_init(struct event_loop *loop) {
+    memset(loop, 0, sizeof(*loop));
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        printf("Error creating event loop: %s\n", strerror(errno));
+        return errno;
+    }
+    return 0;
+}
+
+static int32_t event_loop_register(struct event_loop *loop, struct event_source *source, uint32_t events) {
+    struct epoll_event ev = {0};
+
+    if (loop->count == EVENT_LOOP_MAX_SOURCES) {
+        printf("Error: event loop is full, can't add %s\n", source->name);
+        return ENOSPC;
+    }
+    source->dispatches = 0;
+    source->missed = 0;
+    latency_register(&source->stats, source->name);
+
+    ev.events = events;
+    ev.data.ptr = source;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &ev) != 0) {
+        printf("Error adding %s to the event loop: %s\n", source->name, strerror(errno));
+        return errno;
+    }
+    loop->sources[loop->count++] = source;
+    return 0;
+}
+
+// calls source->handler every period_ms, the first time one period from now.
+// returns 0 on success, otherwise an errno value
+int32_t event_loop_add_timer(struct event_loop *loop, struct event_source *source, uint32_t period_ms) {
+    struct itimerspec spec = {0};
+    int32_t result;
+
+    source->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (source->fd < 0) {
+        printf("Error creating timer for %s: %s\n", source->name, strerror(errno));
+        return errno;
+    }
+    source->is_timer = true;
+    source->period_ms = period_ms;
+
+    // the kernel re-arms the timer from its previous expiry, not from when
+    // the handler finished, so the period does not drift. the first expiry
+    // is absolute so the loop knows when every expiry was due
+    spec.it_interval.tv_sec = period_ms / 1000;
+    spec.it_interval.tv_nsec = (long) (period_ms % 1000) * 1000000L;
+    clock_gettime(CLOCK_MONOTONIC, &source->next_expiry);
+    timespec_add_ms(&source->next_expiry, period_ms);
+    spec.it_value = source->next_expiry;
+    timerfd_settime(source->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+
+    result = event_loop_register(loop, source, EPOLLIN);
+    if (result != 0) {
+        close(source->fd);
+        source->fd = -1;
+    }
+    return result;
+}
+
+// calls source->handler whenever fd reports one of events (EPOLLIN,
+// EPOLLPRI, ...). the handler is responsible for consuming the event.
+// returns 0 on success, otherwise an errno value
+int32_t event_loop_add_fd(struct event_loop *loop, struct event_source *source, int32_t fd, uint32_t events) {
+    source->fd = fd;
+    source->is_timer = false;
+    source->period_ms = 0;
+    return event_loop_register(loop, source, events);
+}
+
+// dispatches events until event_loop_stop() is called.
+// returns 0 when stopped, otherwise the errno of epoll_wait
+int32_t event_loop_run(struct event_loop *loop) {
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    loop->running = true;
+    while (loop->running) {
+        int32_t n = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error waiting for events: %s\n", strerror(errno));
+            return errno;
+        }
+
+        for (int32_t i = 0; i < n && loop->running; i++) {
+            event_loop_dispatch(events[i].data.ptr);
+        }
+    }
+    return 0;
+}
+
+// runs the handler of a ready source and records how late it woke up and
+// how long the handler took
+static void event_loop_dispatch(struct event_source *source) {
+    struct timespec woke, done;
+
+    clock_gettime(CLOCK_MONOTONIC, &woke);
+    if (source->is_timer) {
+        uint64_t expirations = 0;
+        if (read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return;
+        }
+        // more than one expiration means a handler overran its period
+        source->missed += expirations - 1;
+        if (expirations > 1) {
+            latency_miss(&source->stats, expirations - 1);
+        }
+        // wake up latency is measured from the latest expiry
+        timespec_add_ms(&source->next_expiry, (expirations - 1) * source->period_ms);
+        latency_record(&source->stats.wakeup, timespec_diff_ns(&source->next_expiry, &woke));
+        timespec_add_ms(&source->next_expiry, source->period_ms);
+    }
+    source->handler(source);
+    source->dispatches++;
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    latency_record(&source->stats.exec, timespec_diff_ns(&woke, &done));
+}
+
+void event_loop_stop(struct event_loop *loop) {
+    loop->running = false;
+}
+
+// prints how often each source ran and how many timer periods were missed
+void event_loop_report(const struct event_loop *loop) {
+    for (size_t i = 0; i < loop->count; i++) {
+        const struct event_source *source = loop->sources[i];
+        printf("%-20s period %5u ms  dispatches %llu  missed %llu\n",
+               source->name, source->period_ms,
+               (unsigned long long) source->dispatches,
+               (unsigned long long) source->missed);
+    }
+}
+
+// closes the loop and the timers it created. caller supplied fds stay open
+void event_loop_close(struct event_loop *loop) {
+    for (size_t i = 0; i < loop->count; i++) {
+        if (loop->sources[i]->is_timer) {
+            close(loop->sources[i]->fd);
+        }
+    }
+    loop->count = 0;
+    close(loop->epoll_fd);
+}
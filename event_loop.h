@@ -0,0 +1,44 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "latency.h"
+
+#define EVENT_LOOP_MAX_SOURCES 64   // sources one loop can hold
+#define EVENT_LOOP_MAX_EVENTS 16    // events handled per epoll_wait
+
+// something the loop waits on: a periodic timer or any pollable fd (a GPIO
+// edge, a socket). owned by the caller, the loop only keeps a pointer
+struct event_source {
+    const char *name;
+    void (*handler)(struct event_source *source);
+    void *arg;
+
+    // filled in by the loop
+    int32_t fd;
+    bool is_timer;              // fd is a timerfd created by the loop
+    uint32_t period_ms;
+    uint64_t dispatches;        // times the handler ran
+    uint64_t missed;            // timer periods that expired without a dispatch
+    struct timespec next_expiry; // absolute CLOCK_MONOTONIC time of the next timer expiry
+    struct task_stats stats;    // wake up and handler time histograms
+};
+
+struct event_loop {
+    int32_t epoll_fd;
+    bool running;
+    struct event_source *sources[EVENT_LOOP_MAX_SOURCES];
+    size_t count;
+};
+
+int32_t event_loop_init(struct event_loop *loop);
+int32_t event_loop_add_timer(struct event_loop *loop, struct event_source *source, uint32_t period_ms);
+int32_t event_loop_add_fd(struct event_loop *loop, struct event_source *source, int32_t fd, uint32_t events);
+int32_t event_loop_run(struct event_loop *loop);
+void event_loop_stop(struct event_loop *loop);
+void event_loop_report(const struct event_loop *loop);
+void event_loop_close(struct event_loop *loop);
+
+#endif
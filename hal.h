@@ -0,0 +1,65 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define W1_ID_SIZE 32            // "28-" and 12 hex digits, with room to spare
+#define W1_MAX_PROBES 16
+#define W1_MIN_RESOLUTION 9
+#define W1_MAX_RESOLUTION 12
+// DS18B20 conversion time, 750 ms at 12 bits and halved for every bit less
+#define W1_CONVERSION_MS(resolution) ((750 + (1 << (W1_MAX_RESOLUTION - (resolution))) - 1) >> (W1_MAX_RESOLUTION - (resolution)))
+// messages in one I2C_RDWR, the i2c-dev limit
+#define HAL_I2C_MAX_MSGS 42
+
+// one write to a slave in a combined transfer
+struct hal_i2c_msg {
+    int32_t handle;                 // from i2c_open
+    const unsigned char *buf;
+    size_t len;
+};
+
+// hardware backend of the monitor. hal_board talks to the BeagleBone
+// (w1 hwmon, HX711 over /dev/mem, /dev/i2c-N) and hal_sim runs
+// everything in memory so the whole pipeline can run on any Linux box.
+// handles returned by the open calls are small non-negative integers
+struct hal_ops {
+    const char *name;
+
+    // DS18B20s on 1-wire. temperature_discover lists the ids of the probes
+    // on the bus in order. temperature_open takes a probe's w1 device
+    // directory and a resolution of 9 to 12 bits. temperature_convert
+    // starts one conversion on every open probe at once and returns with
+    // the ms until the slowest is done, temperature_read then fetches a
+    // probe's result in millidegrees C without waiting for a new one. a
+    // read without a conversion started converts first and blocks for it
+    int32_t (*temperature_discover)(char (*ids)[W1_ID_SIZE], int32_t max);
+    int32_t (*temperature_open)(const char *path, int32_t resolution);
+    int32_t (*temperature_convert)(int32_t *ready_ms);
+    int32_t (*temperature_read)(int32_t handle, int64_t *millidegrees);
+
+    // HX711 load cells on one shared PD_SCK, raw 24-bit samples.
+    // weight_busy gives the cells still converting, bit c for cell c: after
+    // a timed out wait the others can still be read
+    int32_t (*weight_open)(int32_t sck_pin, const int32_t *dout_pins, size_t count);
+    int32_t (*weight_wait_ready)(int32_t timeout_ms);
+    uint32_t (*weight_busy)();
+    void (*weight_read)(uint32_t *samples);
+
+    // I2C LCD backpacks, one handle per slave address. i2c_transfer sends
+    // up to HAL_I2C_MAX_MSGS writes to slaves of one bus as a single
+    // combined transfer, one START per message and a STOP at the end
+    int32_t (*i2c_open)(const char *bus, int32_t addr);
+    int32_t (*i2c_write)(int32_t handle, const unsigned char *buf, size_t len);
+    int32_t (*i2c_transfer)(const struct hal_i2c_msg *msgs, size_t count);
+    void (*i2c_close)(int32_t handle);
+};
+
+extern const struct hal_ops hal_board;
+extern const struct hal_ops hal_sim;
+
+// backend in use, hal_board unless the program selects another one
+extern const struct hal_ops *hal;
+
+#endif
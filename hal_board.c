@@ -0,0 +1,270 @@
+// BeagleBone backend of the hardware abstraction layer.
+// Temperature probes go through the w1_therm attributes of their w1 device,
+// the HX711s through the mmap'd GPIO1 registers and the LCD through the
+// i2c-dev character device.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include "hal.h"
+#include "hx711.h"
+#include "sysfs_node.h"
+#include "trace.h"
+
+#define BOARD_MAX_PROBES W1_MAX_PROBES
+#define BOARD_MAX_BUSES 4
+#define BOARD_MAX_I2C 8
+
+static const char *W1_Devices = (char *) "/sys/bus/w1/devices";
+
+// a DS18B20. w1_therm starts a conversion on every probe of a bus when
+// "trigger" is written to the bus master's therm_bulk_read, and a read of
+// temperature after that returns the result instead of converting again
+struct board_probe {
+    struct sysfs_node temperature;
+    int32_t bus;                    // index in buses, -1 when the kernel has no bulk read
+    int32_t conversion_ms;
+};
+
+// a w1 bus master with at least one open probe
+struct board_bus {
+    char path[PATH_MAX];
+    struct sysfs_node bulk;
+};
+
+static struct board_probe probes[BOARD_MAX_PROBES];
+static int32_t numProbes = 0;
+static struct board_bus buses[BOARD_MAX_BUSES];
+static int32_t numBuses = 0;
+// an open I2C slave: its i2c-dev descriptor, bound to addr for write(), and
+// addr again for the messages of a combined transfer
+struct board_i2c {
+    int32_t fd;
+    uint16_t addr;
+};
+static struct board_i2c slaves[BOARD_MAX_I2C] = {
+    { -1, 0 }, { -1, 0 }, { -1, 0 }, { -1, 0 }, { -1, 0 }, { -1, 0 }, { -1, 0 }, { -1, 0 },
+};
+static struct hx711_array cells;
+
+const struct hal_ops *hal = &hal_board;
+
+static int compare_ids(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+// every DS18B20 (family 28) under /sys/bus/w1/devices, sorted so the
+// order doesn't depend on the order the bus found them in
+static int32_t board_temperature_discover(char (*ids)[W1_ID_SIZE], int32_t max) {
+    DIR *dir = opendir(W1_Devices);
+    struct dirent *entry;
+    int32_t count = 0;
+
+    if (dir == NULL) {
+        printf("Error: could not open %s: %s\n", W1_Devices, strerror(errno));
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL && count < max) {
+        if (strncmp(entry->d_name, "28-", 3) == 0 && strlen(entry->d_name) < W1_ID_SIZE) {
+            memcpy(ids[count++], entry->d_name, strlen(entry->d_name) + 1);
+        }
+    }
+    closedir(dir);
+    qsort(ids, (size_t) count, W1_ID_SIZE, compare_ids);
+    return count;
+}
+
+// index of the bus master of the probe at path, opened on first use.
+// -1 when it has no therm_bulk_read
+static int32_t board_bus_of(const char *path) {
+    char parent[PATH_MAX];
+    char real[PATH_MAX];
+    char attr[PATH_MAX + 32];
+
+    // the device directory is a link into its bus master's directory
+    snprintf(parent, sizeof(parent), "%s/..", path);
+    if (realpath(parent, real) == NULL) {
+        return -1;
+    }
+    for (int32_t b = 0; b < numBuses; b++) {
+        if (strcmp(buses[b].path, real) == 0) {
+            return b;
+        }
+    }
+    if (numBuses == BOARD_MAX_BUSES) {
+        return -1;
+    }
+    snprintf(attr, sizeof(attr), "%s/therm_bulk_read", real);
+    if (sysfs_open(&buses[numBuses].bulk, attr, O_WRONLY) != 0) {
+        return -1;
+    }
+    snprintf(buses[numBuses].path, sizeof(buses[numBuses].path), "%s", real);
+    return numBuses++;
+}
+
+static int32_t board_temperature_open(const char *path, int32_t resolution) {
+    struct board_probe *probe = &probes[numProbes];
+    struct sysfs_node node;
+    char attr[SYSFS_PATH_SIZE];
+    char value[8];
+
+    if (numProbes == BOARD_MAX_PROBES) {
+        return -1;
+    }
+    snprintf(attr, sizeof(attr), "%s/temperature", path);
+    if (sysfs_open(&probe->temperature, attr, O_RDONLY) != 0) {
+        return -1;
+    }
+    // the probe keeps its resolution until it loses power
+    snprintf(attr, sizeof(attr), "%s/resolution", path);
+    snprintf(value, sizeof(value), "%d", resolution);
+    if (sysfs_open(&node, attr, O_WRONLY) != 0 || sysfs_write(&node, value) != 0) {
+        printf("Warning: could not set %s to %d bits\n", attr, resolution);
+    }
+    sysfs_close(&node);
+    probe->conversion_ms = W1_CONVERSION_MS(resolution);
+
+    probe->bus = board_bus_of(path);
+    if (probe->bus < 0) {
+        printf("Warning: no bulk conversions, reads of %s block for the conversion\n", path);
+    }
+    return numProbes++;
+}
+
+// one trigger per bus converts all of its probes in parallel
+static int32_t board_temperature_convert(int32_t *ready_ms) {
+    bool triggered[BOARD_MAX_BUSES] = {0};
+
+    *ready_ms = 0;
+    for (int32_t b = 0; b < numBuses; b++) {
+        triggered[b] = sysfs_write(&buses[b].bulk, "trigger\n") == 0;
+    }
+    for (int32_t p = 0; p < numProbes; p++) {
+        if (probes[p].bus >= 0 && triggered[probes[p].bus] && probes[p].conversion_ms > *ready_ms) {
+            *ready_ms = probes[p].conversion_ms;
+        }
+    }
+    return *ready_ms > 0 ? 0 : -1;
+}
+
+static int32_t board_temperature_read(int32_t handle, int64_t *millidegrees) {
+    return sysfs_read_int(&probes[handle].temperature, millidegrees);
+}
+
+static int32_t board_weight_open(int32_t sck_pin, const int32_t *dout_pins, size_t count) {
+    int32_t result;
+
+    if (hx711_array_open(&cells, sck_pin, dout_pins, count) != 0) {
+        return -1;
+    }
+    // sleep on the first DOUT's falling edge instead of spinning
+    result = hx711_enable_edge_wait(&cells.dev, HX711_GPIOCHIP, dout_pins[0] - GPIO_BANK_FIRST);
+    if (result != 0) {
+        printf("Warning: no DOUT edge events (%s), waits for the HX711s spin on GPIO_DATAIN\n", strerror(result));
+    }
+    return 0;
+}
+
+// a timeout names the cells that didn't get ready, once each time the set
+// of them changes, so a dead HX711 is found without flooding the console
+static int32_t board_weight_wait_ready(int32_t timeout_ms) {
+    static uint32_t reported = 0;
+    int32_t result = hx711_wait_ready(&cells.dev, timeout_ms);
+    uint32_t busy = result == 1 ? hx711_array_busy(&cells) : 0;
+
+    for (size_t c = 0; c < cells.count && busy != reported; c++) {
+        if (busy & (1u << c)) {
+            trace(TRACE_SENSOR_ERROR, (uint16_t) c, 1);
+            printf("Error: load cell %zu (DOUT GPIO %d) is not ready\n", c + 1, cells.dout_shift[c] + GPIO_BANK_FIRST);
+        }
+    }
+    reported = busy;
+    return result;
+}
+
+static uint32_t board_weight_busy() {
+    return hx711_array_busy(&cells);
+}
+
+static void board_weight_read(uint32_t *samples) {
+    hx711_array_read(&cells, samples);
+}
+
+static int32_t board_i2c_open(const char *bus, int32_t addr) {
+    int32_t handle = 0;
+    int32_t fd;
+
+    while (handle < BOARD_MAX_I2C && slaves[handle].fd >= 0) {
+        handle++;
+    }
+    if (handle == BOARD_MAX_I2C) {
+        printf("Error too many I2C slaves open [0x%02X].\n", addr);
+        return -1;
+    }
+    fd = open(bus, O_RDWR);
+    if (fd < 0) {
+        printf("Error failed to open I2C bus [%s].\n", bus);
+        return -1;
+    }
+    //set the I2C slave address for all subsequent I2C device transfers
+    if (ioctl(fd, I2C_SLAVE, addr) < 0) {
+        printf("Error failed to set I2C address [0x%02X].\n", addr);
+        close(fd);
+        return -1;
+    }
+    slaves[handle].fd = fd;
+    slaves[handle].addr = (uint16_t) addr;
+    return handle;
+}
+
+static int32_t board_i2c_write(int32_t handle, const unsigned char *buf, size_t len) {
+    return write(slaves[handle].fd, buf, len) == (ssize_t) len ? 0 : -1;
+}
+
+// one I2C_RDWR ioctl. the messages carry their own addresses, so any
+// descriptor of the adapter will do
+static int32_t board_i2c_transfer(const struct hal_i2c_msg *msgs, size_t count) {
+    struct i2c_msg segments[HAL_I2C_MAX_MSGS];
+    struct i2c_rdwr_ioctl_data data = { segments, (uint32_t) count };
+
+    if (count == 0 || count > HAL_I2C_MAX_MSGS) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        segments[i].addr = slaves[msgs[i].handle].addr;
+        segments[i].flags = 0;
+        segments[i].len = (uint16_t) msgs[i].len;
+        segments[i].buf = (unsigned char *) msgs[i].buf;
+    }
+    return ioctl(slaves[msgs[0].handle].fd, I2C_RDWR, &data) == (int) count ? 0 : -1;
+}
+
+static void board_i2c_close(int32_t handle) {
+    close(slaves[handle].fd);
+    slaves[handle].fd = -1;
+}
+
+const struct hal_ops hal_board = {
+    .name = "board",
+    .temperature_discover = board_temperature_discover,
+    .temperature_open = board_temperature_open,
+    .temperature_convert = board_temperature_convert,
+    .temperature_read = board_temperature_read,
+    .weight_open = board_weight_open,
+    .weight_wait_ready = board_weight_wait_ready,
+    .weight_busy = board_weight_busy,
+    .weight_read = board_weight_read,
+    .i2c_open = board_i2c_open,
+    .i2c_write = board_i2c_write,
+    .i2c_transfer = board_i2c_transfer,
+    .i2c_close = board_i2c_close,
+};
@@ -0,0 +1,371 @@
+// Simulated backend of the hardware abstraction layer.
+// Weight and temperature follow the curves of a sim_script, GPIO calls are
+// accepted and ignored, and every I2C address gets an in-memory HD44780
+// model that decodes the PCF8574 nibble stream the same way the panel does,
+// so what lcd.c would show can be read back and measured.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "hal.h"
+#include "hal_sim.h"
+
+#define SIM_MAX_CELLS 16
+#define SIM_MAX_PROBES W1_MAX_PROBES
+
+// PCF8574 to HD44780 wiring: D7-D4 on the upper bits, then BL EN RW RS
+#define PCF_EN 0x04
+#define PCF_RS 0x01
+
+struct hd44780_model {
+    bool open;
+    int32_t addr;
+    bool four_bit;                  // after the init sequence switched modes
+    bool have_upper;                // first nibble of a 4-bit transfer latched
+    unsigned char upper;
+    unsigned char prev;             // last expander byte, to spot EN falling
+    bool cgram_mode;                // data goes to CGRAM instead of DDRAM
+    unsigned char address;
+    unsigned char ddram[128];
+    unsigned char cgram[64];
+    struct sim_lcd_stats stats;
+};
+
+static struct sim_script script = {
+    .weight_full_counts = 900000,
+    .weight_empty_counts = 100000,
+    .drain_seconds = 3600,
+    .weight_noise_counts = 500,
+    .spike_every = 50,
+    .temperature_mean = 4,
+    .temperature_swing = 1.5,
+    .temperature_period_s = 600,
+    .sample_rate = 10,
+    .conversion_us = 750000,
+    .probes = 8,
+};
+
+static struct timespec epoch;
+static bool started = false;
+static size_t numCells = 0;
+static int64_t lastConversion = -1;
+static uint64_t samplesRead = 0;
+static unsigned int seed = 1;
+static int32_t numProbes = 0;
+static int32_t probeResolution[SIM_MAX_PROBES];
+static double probeReady[SIM_MAX_PROBES];      // when the started conversion is done, -1 for none
+static struct hd44780_model lcds[SIM_MAX_LCDS];
+static uint64_t busTransfers = 0;
+
+// seconds since the simulation started
+static double sim_now() {
+    struct timespec now;
+
+    if (!started) {
+        clock_gettime(CLOCK_MONOTONIC, &epoch);
+        started = true;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - epoch.tv_sec) + (now.tv_nsec - epoch.tv_nsec) / 1e9;
+}
+
+void hal_sim_configure(const struct sim_script *new_script) {
+    script = *new_script;
+}
+
+const struct sim_script *hal_sim_script() {
+    return &script;
+}
+
+// ids that look like DS18B20s, in the order the board backend sorts them
+static int32_t sim_temperature_discover(char (*ids)[W1_ID_SIZE], int32_t max) {
+    int32_t count = (int32_t) script.probes < max ? (int32_t) script.probes : max;
+
+    for (int32_t p = 0; p < count; p++) {
+        snprintf(ids[p], W1_ID_SIZE, "28-0000000000%02x", p + 1);
+    }
+    return count;
+}
+
+static int32_t sim_temperature_open(const char *path, int32_t resolution) {
+    (void) path;
+    if (numProbes == SIM_MAX_PROBES) {
+        return -1;
+    }
+    probeResolution[numProbes] = resolution;
+    probeReady[numProbes] = -1;
+    return numProbes++;
+}
+
+// conversion_us is the 12 bit time, it halves with every bit less
+static double sim_conversion_s(int32_t handle) {
+    return script.conversion_us / 1e6 / (1 << (W1_MAX_RESOLUTION - probeResolution[handle]));
+}
+
+// all probes convert at once, the slowest resolution sets the wait
+static int32_t sim_temperature_convert(int32_t *ready_ms) {
+    double now = sim_now();
+
+    *ready_ms = 0;
+    for (int32_t p = 0; p < numProbes; p++) {
+        int32_t ms = (int32_t) ceil(sim_conversion_s(p) * 1000);
+
+        probeReady[p] = now + sim_conversion_s(p);
+        *ready_ms = ms > *ready_ms ? ms : *ready_ms;
+    }
+    return 0;
+}
+
+// blocks until the conversion is done like a DS18B20 read does, the whole
+// conversion time when none was started
+static int32_t sim_temperature_read(int32_t handle, int64_t *millidegrees) {
+    double wait = probeReady[handle] < 0 ? sim_conversion_s(handle) : probeReady[handle] - sim_now();
+    double step = 62.5 * (1 << (W1_MAX_RESOLUTION - probeResolution[handle]));
+    double t;
+
+    if (wait > 0) {
+        usleep((useconds_t) (wait * 1e6));
+    }
+    probeReady[handle] = -1;
+    t = sim_now();
+    // each probe is offset by a tenth of a degree so they can be told
+    // apart, and rounded down to the resolution like the scratchpad is
+    *millidegrees = (int64_t) (floor(1000 * (script.temperature_mean + handle * 0.1 +
+                    script.temperature_swing * sin(2 * M_PI * t / script.temperature_period_s)) / step) * step);
+    return 0;
+}
+
+static int32_t sim_weight_open(int32_t sck_pin, const int32_t *dout_pins, size_t count) {
+    (void) sck_pin;
+    (void) dout_pins;
+    numCells = count < SIM_MAX_CELLS ? count : SIM_MAX_CELLS;
+    sim_now();
+    return 0;
+}
+
+// a new conversion completes every 1/sample_rate seconds, except on the
+// dead cells which keep the array from ever getting ready
+static int32_t sim_weight_wait_ready(int32_t timeout_ms) {
+    double now = sim_now();
+    int64_t conversion = (int64_t) (now * script.sample_rate);
+    double wait;
+
+    if ((script.dead_cells & ((1u << numCells) - 1)) != 0) {
+        if (timeout_ms >= 0) {
+            usleep((useconds_t) timeout_ms * 1000);
+        }
+        return 1;
+    }
+    if (conversion > lastConversion) {
+        return 0;
+    }
+    wait = (double) (conversion + 1) / script.sample_rate - now;
+    if (timeout_ms >= 0 && wait * 1000 > timeout_ms) {
+        usleep((useconds_t) timeout_ms * 1000);
+        return 1;
+    }
+    usleep((useconds_t) (wait * 1e6));
+    return 0;
+}
+
+// all cells are busy until the next conversion, the dead ones for good
+static uint32_t sim_weight_busy() {
+    int64_t conversion = (int64_t) (sim_now() * script.sample_rate);
+    uint32_t all = (1u << numCells) - 1;
+
+    return conversion > lastConversion ? script.dead_cells & all : all;
+}
+
+static void sim_weight_read(uint32_t *samples) {
+    double now = sim_now();
+    double range = script.weight_full_counts - script.weight_empty_counts;
+
+    lastConversion = (int64_t) (now * script.sample_rate);
+    samplesRead++;
+    for (size_t c = 0; c < numCells; c++) {
+        double phase = now / script.drain_seconds + (double) c / numCells;
+        double counts = script.weight_full_counts - range * (phase - floor(phase));
+
+        counts += script.weight_noise_counts * (2.0 * rand_r(&seed) / RAND_MAX - 1.0);
+        if (script.spike_every != 0 && samplesRead % script.spike_every == 0) {
+            counts += range;
+        }
+        samples[c] = (uint32_t) (int32_t) counts & 0xFFFFFF;
+    }
+}
+
+static int32_t sim_i2c_open(const char *bus, int32_t addr) {
+    int32_t free_slot = -1;
+
+    (void) bus;
+    for (int32_t i = 0; i < SIM_MAX_LCDS; i++) {
+        if (lcds[i].open && lcds[i].addr == addr) {
+            return i;
+        }
+        if (!lcds[i].open && free_slot < 0) {
+            free_slot = i;
+        }
+    }
+    if (free_slot >= 0) {
+        memset(&lcds[free_slot], 0, sizeof(lcds[free_slot]));
+        memset(lcds[free_slot].ddram, ' ', sizeof(lcds[free_slot].ddram));
+        lcds[free_slot].open = true;
+        lcds[free_slot].addr = addr;
+    }
+    return free_slot;
+}
+
+// runs one decoded HD44780 instruction or data write
+static void hd44780_execute(struct hd44780_model *lcd, unsigned char value, bool rs) {
+    if (rs) {
+        lcd->stats.data_writes++;
+        if (lcd->cgram_mode) {
+            lcd->cgram[lcd->address & 0x3F] = value;
+            lcd->address = (lcd->address + 1) & 0x3F;
+        } else {
+            lcd->ddram[lcd->address & 0x7F] = value;
+            // two line mode: line 1 is 0x00-0x27, line 2 is 0x40-0x67
+            lcd->address++;
+            if (lcd->address == 0x28) {
+                lcd->address = 0x40;
+            } else if (lcd->address == 0x68) {
+                lcd->address = 0x00;
+            }
+        }
+        return;
+    }
+
+    lcd->stats.commands++;
+    if (value & 0x80) {
+        lcd->address = value & 0x7F;
+        lcd->cgram_mode = false;
+    } else if (value & 0x40) {
+        lcd->address = value & 0x3F;
+        lcd->cgram_mode = true;
+    } else if (value & 0x20) {
+        // function set, DL=0 selects the 4-bit interface
+        lcd->four_bit = (value & 0x10) == 0;
+        lcd->have_upper = false;
+    } else if (value == 0x01) {
+        memset(lcd->ddram, ' ', sizeof(lcd->ddram));
+        lcd->address = 0;
+        lcd->cgram_mode = false;
+    } else if ((value & 0xFE) == 0x02) {
+        lcd->address = 0;
+        lcd->cgram_mode = false;
+    }
+    // entry mode, display control and shifts don't change what is stored
+}
+
+// feeds one expander byte to the model. the HD44780 latches D7-D4 on the
+// falling edge of EN
+static void hd44780_feed(struct hd44780_model *lcd, unsigned char byte) {
+    bool falling = (lcd->prev & PCF_EN) && !(byte & PCF_EN);
+    unsigned char nibble = lcd->prev & 0xF0;
+    bool rs = (lcd->prev & PCF_RS) != 0;
+
+    lcd->prev = byte;
+    if (!falling) {
+        return;
+    }
+    if (!lcd->four_bit) {
+        hd44780_execute(lcd, nibble, rs);
+    } else if (!lcd->have_upper) {
+        lcd->upper = nibble;
+        lcd->have_upper = true;
+    } else {
+        lcd->have_upper = false;
+        hd44780_execute(lcd, lcd->upper | (nibble >> 4), rs);
+    }
+}
+
+// one message to a panel
+static void hd44780_write(struct hd44780_model *lcd, const unsigned char *buf, size_t len) {
+    lcd->stats.writes++;
+    lcd->stats.bytes += len;
+    for (size_t i = 0; i < len; i++) {
+        hd44780_feed(lcd, buf[i]);
+    }
+}
+
+static int32_t sim_i2c_write(int32_t handle, const unsigned char *buf, size_t len) {
+    struct hd44780_model *lcd = &lcds[handle];
+
+    busTransfers++;
+    hd44780_write(lcd, buf, len);
+    return 0;
+}
+
+// every message reaches its panel as if written on its own, but the whole
+// batch is one bus transfer
+static int32_t sim_i2c_transfer(const struct hal_i2c_msg *msgs, size_t count) {
+    if (count == 0 || count > HAL_I2C_MAX_MSGS) {
+        return -1;
+    }
+    busTransfers++;
+    for (size_t i = 0; i < count; i++) {
+        hd44780_write(&lcds[msgs[i].handle], msgs[i].buf, msgs[i].len);
+    }
+    return 0;
+}
+
+// I2C_RDWR and write() calls on every bus so far
+uint64_t hal_sim_i2c_transfers() {
+    return busTransfers;
+}
+
+static void sim_i2c_close(int32_t handle) {
+    lcds[handle].open = false;
+}
+
+// copies the cols visible characters of row into out (NUL terminated).
+// rows start at DDRAM 0x00, 0x40, 0x14 and 0x54 as on 16x2 and 20x4 panels.
+// returns 0 on success, -1 for an unknown handle or row
+int32_t hal_sim_lcd_text(int32_t handle, int32_t row, int32_t cols, char *out) {
+    static const unsigned char row_start[] = { 0x00, 0x40, 0x14, 0x54 };
+
+    if (handle < 0 || handle >= SIM_MAX_LCDS || row < 0 || row > 3) {
+        return -1;
+    }
+    for (int32_t c = 0; c < cols; c++) {
+        out[c] = (char) lcds[handle].ddram[(row_start[row] + c) & 0x7F];
+    }
+    out[cols] = '\0';
+    return 0;
+}
+
+// copies the 64 bytes of CGRAM (8 glyphs of 8 rows)
+int32_t hal_sim_lcd_cgram(int32_t handle, unsigned char *out) {
+    if (handle < 0 || handle >= SIM_MAX_LCDS) {
+        return -1;
+    }
+    memcpy(out, lcds[handle].cgram, sizeof(lcds[handle].cgram));
+    return 0;
+}
+
+void hal_sim_lcd_stats(int32_t handle, struct sim_lcd_stats *out) {
+    *out = lcds[handle].stats;
+}
+
+void hal_sim_lcd_reset_stats(int32_t handle) {
+    memset(&lcds[handle].stats, 0, sizeof(lcds[handle].stats));
+}
+
+const struct hal_ops hal_sim = {
+    .name = "sim",
+    .temperature_discover = sim_temperature_discover,
+    .temperature_open = sim_temperature_open,
+    .temperature_convert = sim_temperature_convert,
+    .temperature_read = sim_temperature_read,
+    .weight_open = sim_weight_open,
+    .weight_wait_ready = sim_weight_wait_ready,
+    .weight_busy = sim_weight_busy,
+    .weight_read = sim_weight_read,
+    .i2c_open = sim_i2c_open,
+    .i2c_write = sim_i2c_write,
+    .i2c_transfer = sim_i2c_transfer,
+    .i2c_close = sim_i2c_close,
+};
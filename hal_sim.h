@@ -0,0 +1,43 @@
+#ifndef HAL_SIM_H
+#define HAL_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIM_MAX_LCDS 8          // simulated panels, one per I2C address
+
+// scripted sensor curves of the simulated backend. every keg drains from
+// full to empty over drain_seconds, each one phase shifted, and wraps
+// around (a keg swap)
+struct sim_script {
+    double weight_full_counts;      // raw HX711 count of a full keg
+    double weight_empty_counts;     // raw HX711 count of an empty keg
+    double drain_seconds;           // time for a keg to go from full to empty
+    double weight_noise_counts;     // amplitude of the uniform sample noise
+    uint32_t spike_every;           // every Nth sample is a spike, 0 for none
+    uint32_t dead_cells;            // cells that never convert, bit c for cell c
+    double temperature_mean;        // degrees C
+    double temperature_swing;       // amplitude of the slow sine, degrees C
+    double temperature_period_s;    // period of the sine
+    uint32_t sample_rate;           // HX711 conversions per second, 10 or 80
+    uint32_t conversion_us;         // DS18B20 conversion at 12 bits, 750 ms
+    uint32_t probes;                // DS18B20s found on the bus
+};
+
+// what the simulated HD44780 received
+struct sim_lcd_stats {
+    uint64_t bytes;                 // expander bytes written to the bus
+    uint64_t writes;                // messages, one per write() or I2C_RDWR segment
+    uint64_t commands;              // decoded HD44780 instructions
+    uint64_t data_writes;           // decoded character / CGRAM writes
+};
+
+void hal_sim_configure(const struct sim_script *script);
+const struct sim_script *hal_sim_script();
+int32_t hal_sim_lcd_text(int32_t handle, int32_t row, int32_t cols, char *out);
+int32_t hal_sim_lcd_cgram(int32_t handle, unsigned char *out);
+void hal_sim_lcd_stats(int32_t handle, struct sim_lcd_stats *out);
+void hal_sim_lcd_reset_stats(int32_t handle);
+uint64_t hal_sim_i2c_transfers();
+
+#endif
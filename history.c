@@ -0,0 +1,101 @@
+// Ring buffer history of timestamped sensor samples and the streaming
+// filters that smooth them: outlier rejection against the running median,
+// the running median itself and an EMA on top of it. One noisy HX711 sample
+// no longer moves the displayed percentage.
+
+#include <string.h>
+#include <math.h>
+#include "history.h"
+
+static void median_insert(struct sample_history *h, double value);
+static void median_reset(struct sample_history *h, double value);
+
+// ema_alpha is the weight of the newest median (0 < alpha <= 1).
+// outlier_limit is the largest accepted distance from the median, 0 disables it
+void history_init(struct sample_history *h, double ema_alpha, double outlier_limit) {
+    memset(h, 0, sizeof(*h));
+    h->ema_alpha = ema_alpha;
+    h->outlier_limit = outlier_limit;
+}
+
+// replaces the oldest window value with value, keeping sorted[] in order.
+// O(MEDIAN_WINDOW), independent of the history length
+static void median_insert(struct sample_history *h, double value) {
+    uint32_t n = h->window_fill;
+    uint32_t i;
+
+    if (n == MEDIAN_WINDOW) {
+        // remove the value leaving the window from the sorted copy
+        double oldest = h->window[h->window_next];
+        for (i = 0; i < n && h->sorted[i] != oldest; i++) {
+        }
+        memmove(&h->sorted[i], &h->sorted[i + 1], (n - i - 1) * sizeof(double));
+        n--;
+    } else {
+        h->window_fill++;
+    }
+    h->window[h->window_next] = value;
+    h->window_next = (h->window_next + 1) % MEDIAN_WINDOW;
+
+    for (i = n; i > 0 && h->sorted[i - 1] > value; i--) {
+        h->sorted[i] = h->sorted[i - 1];
+    }
+    h->sorted[i] = value;
+}
+
+// restarts the filters at value, used when the level really changed
+static void median_reset(struct sample_history *h, double value) {
+    h->window_fill = 0;
+    h->window_next = 0;
+    median_insert(h, value);
+    h->ema = value;
+}
+
+double history_median(const struct sample_history *h) {
+    if (h->window_fill == 0) {
+        return 0;
+    }
+    return h->sorted[h->window_fill / 2];
+}
+
+// stores a sample and runs it through the filters.
+// returns the new filtered value
+double history_push(struct sample_history *h, double value, const struct timespec *time) {
+    struct sample *slot = &h->samples[h->count % HISTORY_CAPACITY];
+    bool rejected = false;
+
+    if (h->outlier_limit > 0 && h->window_fill == MEDIAN_WINDOW &&
+        fabs(value - history_median(h)) > h->outlier_limit) {
+        rejected = true;
+        h->rejected++;
+        if (++h->rejected_run >= MEDIAN_WINDOW) {
+            // a full window of "outliers" means the keg really changed
+            median_reset(h, value);
+            h->rejected_run = 0;
+            rejected = false;
+        }
+    } else {
+        h->rejected_run = 0;
+        median_insert(h, value);
+        if (h->count == 0) {
+            h->ema = value;
+        }
+        h->ema += h->ema_alpha * (history_median(h) - h->ema);
+    }
+
+    slot->value = value;
+    slot->time = *time;
+    slot->rejected = rejected;
+    h->count++;
+
+    h->filtered = h->ema;
+    return h->filtered;
+}
+
+// most recent sample, NULL when nothing was pushed yet
+const struct sample *history_latest(const struct sample_history *h) {
+    if (h->count == 0) {
+        return NULL;
+    }
+    return &h->samples[(h->count - 1) % HISTORY_CAPACITY];
+}
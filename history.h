@@ -0,0 +1,49 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#define CACHE_LINE 64
+#define HISTORY_CAPACITY 256   // samples kept per sensor, power of two
+#define MEDIAN_WINDOW 9        // samples in the running median, odd
+
+struct sample {
+    double value;
+    struct timespec time;      // CLOCK_MONOTONIC time of the sample
+    bool rejected;             // dropped by the outlier filter
+};
+
+// fixed size sample history of one sensor plus the streaming filters fed
+// from it. every push is O(1) in the history length, so memory and cost
+// stay the same no matter how long the unit runs. written by a single task
+struct sample_history {
+    struct sample samples[HISTORY_CAPACITY] __attribute__((aligned(CACHE_LINE)));
+    uint64_t count;                    // samples pushed so far, head = count % capacity
+
+    // running median over the last MEDIAN_WINDOW accepted samples
+    double window[MEDIAN_WINDOW];      // in arrival order, a ring
+    double sorted[MEDIAN_WINDOW];      // same values kept sorted
+    uint32_t window_fill;
+    uint32_t window_next;
+
+    // exponential moving average of the median
+    double ema_alpha;
+    double ema;
+
+    // a sample further than outlier_limit from the median is rejected;
+    // MEDIAN_WINDOW rejections in a row are taken as a real level change
+    double outlier_limit;
+    uint32_t rejected_run;
+    uint64_t rejected;
+
+    double filtered;                   // latest filter output
+} __attribute__((aligned(CACHE_LINE)));
+
+void history_init(struct sample_history *h, double ema_alpha, double outlier_limit);
+double history_push(struct sample_history *h, double value, const struct timespec *time);
+const struct sample *history_latest(const struct sample_history *h);
+double history_median(const struct sample_history *h);
+
+#endif
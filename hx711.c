@@ -0,0 +1,370 @@
+// Register level access to an HX711 load cell amplifier on the BeagleBone.
+// Resources used:
+// https://elinux.org/EBC_Exercise_11b_gpio_via_mmap
+// https://www.ti.com/lit/ug/spruh73q/spruh73q.pdf
+// https://www.kernel.org/doc/html/latest/userspace-api/gpio/chardev_v1.html
+//
+// PD_SCK and DOUT are driven through the mmap'd GPIO1 registers. Waiting for
+// the HX711 to pull DOUT low (data ready) can either spin on GPIO_DATAIN or
+// sleep in poll() on a falling edge line event from the GPIO character
+// device, which keeps the reader close to idle between samples.
+//
+// The clock-out uses a spin delay calibrated against CLOCK_MONOTONIC at
+// startup rather than usleep(), which sleeps tens of microseconds and can
+// hold PD_SCK high long enough for the HX711 to power down mid sample.
+//
+// Several HX711s can share one PD_SCK (struct hx711_array). Every clock edge
+// then takes a single GPIO_DATAIN read that holds one bit of every cell, and
+// the captured words are transposed into per-cell samples afterwards, so N
+// cells cost the same bus time as one.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/gpio.h>
+#include "hx711.h"
+#include "trace.h"
+
+// iterations of the spin loop per microsecond, set by hx711_calibrate_delay()
+static uint32_t loops_per_us = 0;
+
+static void hx711_drain_events(struct hx711 *dev);
+static void hx711_deadline(struct timespec *deadline, int32_t timeout_ms);
+static bool hx711_expired(const struct timespec *deadline, int32_t timeout_ms);
+static void hx711_spin(uint32_t loops);
+static void hx711_pulse(struct hx711 *dev);
+
+// busy loop the compiler cannot remove
+static void hx711_spin(uint32_t loops) {
+    for (volatile uint32_t i = 0; i < loops; i++) {
+    }
+}
+
+static uint64_t elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (uint64_t) (end->tv_sec - start->tv_sec) * 1000000000ull + (uint64_t) (end->tv_nsec - start->tv_nsec);
+}
+
+// measures how many spin iterations fit in a microsecond. the loop is run
+// several times and the fastest run is kept, so a preemption during
+// calibration makes the delays longer rather than too short
+void hx711_calibrate_delay() {
+    const uint32_t probe = 1000000;
+    uint64_t best = UINT64_MAX;
+
+    for (int32_t run = 0; run < 5; run++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        hx711_spin(probe);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (elapsed_ns(&start, &end) < best) {
+            best = elapsed_ns(&start, &end);
+        }
+    }
+    loops_per_us = (uint32_t) ((uint64_t) probe * 1000 / (best ? best : 1));
+    if (loops_per_us == 0) {
+        loops_per_us = 1;
+    }
+}
+
+// maps the GPIO1 registers and configures PD_SCK as output and DOUT as input.
+// both pins must be on GPIO1. returns 0 on success, negative on failure
+int32_t hx711_open(struct hx711 *dev, int32_t sck_pin, int32_t dout_pin) {
+    uint32_t mem;
+
+    dev->event_fd = -1;
+    dev->gain = HX711_GAIN_A128;
+    if (!GPIO_IN_BANK(sck_pin) || !GPIO_IN_BANK(dout_pin)) {
+        printf("Error: HX711 on GPIO %d/%d, only GPIO %d..%d are mapped\n",
+               sck_pin, dout_pin, GPIO_BANK_FIRST, GPIO_BANK_FIRST + GPIO_BANK_PINS - 1);
+        return -4;
+    }
+    if (loops_per_us == 0) {
+        hx711_calibrate_delay();
+    }
+    dev->sck_bit = 1u << (sck_pin - GPIO_BANK_FIRST);
+    dev->dout_bit = 1u << (dout_pin - GPIO_BANK_FIRST);
+
+    dev->mem_fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if (dev->mem_fd < 0) {
+        perror("Failed to open /dev/mem");
+        return -1;
+    }
+
+    dev->gpio_addr = mmap(NULL, BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, dev->mem_fd, GPIO_ADDRESS_BASE);
+    if (dev->gpio_addr == MAP_FAILED) {
+        perror("Failed to mmap");
+        close(dev->mem_fd);
+        return -2;
+    }
+
+    // initialize necessary gpio memory addresses
+    dev->setdataout = dev->gpio_addr + GPIO_SETDATAOUT / WORD_SIZE;
+    dev->cleardataout = dev->gpio_addr + GPIO_CLEARDATAOUT / WORD_SIZE;
+    dev->datain = dev->gpio_addr + GPIO_DATAIN / WORD_SIZE;
+    dev->oe = dev->gpio_addr + GPIO_OE / WORD_SIZE;
+
+    // set PD_SCK to output (0) and DOUT to input (1)
+    mem = *dev->oe;
+    mem &= ~dev->sck_bit;
+    mem |= dev->dout_bit;
+    *dev->oe = mem;
+
+    // set SCK's value to 0
+    *dev->cleardataout = dev->sck_bit;
+    return 0;
+}
+
+// requests falling edge events for DOUT from the GPIO character device so
+// hx711_wait_ready() can sleep instead of spinning. line is the offset of
+// DOUT within the chip. the pin keeps being read through the mmap'd
+// registers for the clock-out, the event fd only signals data ready.
+// returns 0 on success, otherwise the errno of the failing call
+int32_t hx711_enable_edge_wait(struct hx711 *dev, const char *chip_path, uint32_t line) {
+    struct gpioevent_request req = {0};
+    int32_t chip_fd;
+    int32_t result = 0;
+
+    chip_fd = open(chip_path, O_RDONLY);
+    if (chip_fd < 0) {
+        result = errno;
+        printf("Error failed to open GPIO chip [%s]: %s\n", chip_path, strerror(result));
+        return result;
+    }
+
+    req.lineoffset = line;
+    req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+    strncpy(req.consumer_label, "hx711-dout", sizeof(req.consumer_label) - 1);
+
+    if (ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+        result = errno;
+        printf("Error failed to request edge events for line %u: %s\n", line, strerror(result));
+    } else {
+        dev->event_fd = req.fd;
+        dev->event_line = line;
+        // events are drained without blocking before every wait
+        fcntl(dev->event_fd, F_SETFL, fcntl(dev->event_fd, F_GETFL) | O_NONBLOCK);
+    }
+    close(chip_fd);
+    return result;
+}
+
+// discards queued edge events. DOUT toggles with every data bit during the
+// clock-out, which leaves stale falling edges in the queue
+static void hx711_drain_events(struct hx711 *dev) {
+    struct gpioevent_data event;
+    while (read(dev->event_fd, &event, sizeof(event)) == sizeof(event)) {
+    }
+}
+
+// the CLOCK_MONOTONIC time timeout_ms from now
+static void hx711_deadline(struct timespec *deadline, int32_t timeout_ms) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_nsec -= 1000000000L;
+        deadline->tv_sec++;
+    }
+}
+
+// true once deadline has passed, never for a negative timeout_ms
+static bool hx711_expired(const struct timespec *deadline, int32_t timeout_ms) {
+    struct timespec now;
+
+    if (timeout_ms < 0) {
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+// waits until the HX711 pulls DOUT low to signal a conversion is ready.
+// with several DOUTs in dout_bit it waits until every one of them is low.
+// returns 0 when data is ready, 1 on timeout and negative on error.
+// a negative timeout_ms waits forever; without an event fd it busy waits
+int32_t hx711_wait_ready(struct hx711 *dev, int32_t timeout_ms) {
+    struct timespec deadline;
+    struct pollfd pfd;
+    int32_t result;
+
+    hx711_deadline(&deadline, timeout_ms);
+    if (dev->event_fd < 0) {
+        // spin while DOUT is HIGH, a cell that never converts must not
+        // keep a real-time reader on its core forever
+        while (*dev->datain & dev->dout_bit) {
+            if (hx711_expired(&deadline, timeout_ms)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    hx711_drain_events(dev);
+    // the edge may have happened before the queue was drained
+    if ((*dev->datain & dev->dout_bit) == 0) {
+        return 0;
+    }
+
+    pfd.fd = dev->event_fd;
+    pfd.events = POLLIN;
+    do {
+        result = poll(&pfd, 1, timeout_ms);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0) {
+        perror("poll on HX711 DOUT");
+        return -1;
+    }
+    if (result == 0) {
+        return 1;
+    }
+    trace(TRACE_GPIO_EDGE, (uint16_t) dev->event_line, 0);
+    // the event only covers the first DOUT, the other cells of an array
+    // finish their conversion shortly after and hold DOUT low until read.
+    // an unplugged cell never does, and must not stop the others for good
+    while (*dev->datain & dev->dout_bit) {
+        struct timespec pause = { 0, 50000 };
+
+        if (hx711_expired(&deadline, timeout_ms)) {
+            return 1;
+        }
+        nanosleep(&pause, NULL);
+    }
+    return 0;
+}
+
+// selects the channel and gain used from the next conversion on
+void hx711_set_gain(struct hx711 *dev, enum hx711_gain gain) {
+    dev->gain = gain;
+}
+
+// one PD_SCK pulse that does not sample DOUT
+static void hx711_pulse(struct hx711 *dev) {
+    *dev->setdataout = dev->sck_bit;
+    hx711_spin(loops_per_us * HX711_SCK_HIGH_NS / 1000);
+    *dev->cleardataout = dev->sck_bit;
+    hx711_spin(loops_per_us * HX711_SCK_LOW_NS / 1000);
+}
+
+// clocks the 24-bit conversion result out of the HX711, MSB first, then
+// sends the extra 1 to 3 pulses that select the next channel and gain.
+// a full 25-27 pulse sample takes roughly 55us
+uint32_t hx711_read(struct hx711 *dev) {
+    const uint32_t high = loops_per_us * HX711_SCK_HIGH_NS / 1000;
+    const uint32_t low = loops_per_us * HX711_SCK_LOW_NS / 1000;
+    uint32_t data = 0;
+
+    for (int32_t i = 0; i < HX711_DATA_BITS; i++) {
+        // set PD_SCK high, DOUT is valid 0.1us after the rising edge
+        *dev->setdataout = dev->sck_bit;
+        hx711_spin(high);
+
+        // Read bit from DOUT
+        data = (data << 1) | ((*dev->datain & dev->dout_bit) != 0);
+
+        // set PD_SCK low
+        *dev->cleardataout = dev->sck_bit;
+        hx711_spin(low);
+    }
+
+    for (int32_t i = HX711_DATA_BITS; i < (int32_t) dev->gain; i++) {
+        hx711_pulse(dev);
+    }
+    return data;
+}
+
+// opens count HX711s that share sck_pin. every DOUT pin must be on the
+// same GPIO bank. edge waits requested on arr->dev use the first cell's DOUT.
+// returns 0 on success, negative on failure
+int32_t hx711_array_open(struct hx711_array *arr, int32_t sck_pin, const int32_t *dout_pins, size_t count) {
+    uint32_t mask = 0;
+    int32_t result;
+
+    if (count == 0 || count > HX711_MAX_CELLS) {
+        printf("Error: %zu load cells requested, at most %d supported\n", count, HX711_MAX_CELLS);
+        return -3;
+    }
+    for (size_t c = 0; c < count; c++) {
+        if (!GPIO_IN_BANK(dout_pins[c])) {
+            printf("Error: load cell %zu on DOUT GPIO %d, only GPIO %d..%d are mapped\n",
+                   c, dout_pins[c], GPIO_BANK_FIRST, GPIO_BANK_FIRST + GPIO_BANK_PINS - 1);
+            return -4;
+        }
+    }
+    result = hx711_open(&arr->dev, sck_pin, dout_pins[0]);
+    if (result != 0) {
+        return result;
+    }
+
+    for (size_t c = 0; c < count; c++) {
+        arr->dout_shift[c] = (uint8_t) (dout_pins[c] - GPIO_BANK_FIRST);
+        mask |= 1u << arr->dout_shift[c];
+    }
+    arr->count = count;
+    arr->dev.dout_bit = mask;
+
+    // set every DOUT to input (1)
+    *arr->dev.oe |= mask;
+    return 0;
+}
+
+// the cells whose DOUT is still high, bit c for cell c. after a timed out
+// hx711_wait_ready() these are the ones that didn't finish a conversion
+uint32_t hx711_array_busy(struct hx711_array *arr) {
+    const uint32_t datain = *arr->dev.datain;
+    uint32_t busy = 0;
+
+    for (size_t c = 0; c < arr->count; c++) {
+        busy |= ((datain >> arr->dout_shift[c]) & 1u) << c;
+    }
+    return busy;
+}
+
+// clocks one sample out of every cell in the array on the shared PD_SCK.
+// samples must hold arr->count entries and receives the raw 24-bit values
+void hx711_array_read(struct hx711_array *arr, uint32_t *samples) {
+    struct hx711 *dev = &arr->dev;
+    const uint32_t high = loops_per_us * HX711_SCK_HIGH_NS / 1000;
+    const uint32_t low = loops_per_us * HX711_SCK_LOW_NS / 1000;
+    uint32_t frames[HX711_DATA_BITS];
+
+    // keep the time between edges minimal: capture whole register words
+    // while clocking and only sort the bits out once PD_SCK is low
+    for (int32_t i = 0; i < HX711_DATA_BITS; i++) {
+        *dev->setdataout = dev->sck_bit;
+        hx711_spin(high);
+        frames[i] = *dev->datain;
+        *dev->cleardataout = dev->sck_bit;
+        hx711_spin(low);
+    }
+    for (int32_t i = HX711_DATA_BITS; i < (int32_t) dev->gain; i++) {
+        hx711_pulse(dev);
+    }
+
+    // transpose: bit i of cell c is bit dout_shift[c] of frame i
+    for (size_t c = 0; c < arr->count; c++) {
+        const uint32_t shift = arr->dout_shift[c];
+        uint32_t data = 0;
+        for (int32_t i = 0; i < HX711_DATA_BITS; i++) {
+            data = (data << 1) | ((frames[i] >> shift) & 1u);
+        }
+        samples[c] = data;
+    }
+}
+
+void hx711_close(struct hx711 *dev) {
+    if (dev->event_fd >= 0) {
+        close(dev->event_fd);
+        dev->event_fd = -1;
+    }
+    munmap((void *) dev->gpio_addr, BLOCK_SIZE);
+    close(dev->mem_fd);
+}
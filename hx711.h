@@ -0,0 +1,81 @@
+#ifndef HX711_H
+#define HX711_H
+
+#include <stdint.h>
+
+#define GPIO_ADDRESS_BASE 0x4804C000  // Base address for GPIO1 registers
+#define GPIO_END_ADDRESS 0x4804D000
+// note: since these GPIOs are on GPIOChip1, bit number = (GPIO Number - 32)
+// ex. GPIO 48 - 32 = 16th bit
+#define GPIO_BANK_FIRST 32            // first GPIO number of GPIOChip1
+#define GPIO_BANK_PINS 32             // GPIOs on GPIOChip1, the only bank mapped
+#define GPIO_IN_BANK(pin) ((pin) >= GPIO_BANK_FIRST && (pin) < GPIO_BANK_FIRST + GPIO_BANK_PINS)
+#define PD_SCK_PIN 48                 // GPIO number for PD_SCK
+#define DOUT_PIN 49                   // GPIO number for DOUT
+#define BLOCK_SIZE (GPIO_END_ADDRESS - GPIO_ADDRESS_BASE)
+// used for clear and setting the value of output GPIO pins
+#define GPIO_SETDATAOUT 0x194
+#define GPIO_CLEARDATAOUT 0x190
+// used for reading the values of GPIO pins with direction "in" or "out"
+#define GPIO_DATAIN 0x138
+// used for setting a GPIO pin to output or input
+#define GPIO_OE 0x134
+#define WORD_SIZE 4
+// character device of GPIOChip1, used for DOUT falling edge events
+#define HX711_GPIOCHIP "/dev/gpiochip1"
+
+// PD_SCK timing, inside the datasheet window of 0.2us minimum and 50us
+// maximum high time (the chip powers down when SCK stays high past 60us)
+#define HX711_SCK_HIGH_NS 1000
+#define HX711_SCK_LOW_NS 1000
+#define HX711_DATA_BITS 24
+
+// the number of PD_SCK pulses after the 24 data bits selects the channel
+// and gain of the next conversion
+enum hx711_gain {
+    HX711_GAIN_A128 = 25,  // channel A, gain 128
+    HX711_GAIN_B32 = 26,   // channel B, gain 32
+    HX711_GAIN_A64 = 27,   // channel A, gain 64
+};
+
+// converts a raw 24-bit two's complement sample to a signed count
+#define HX711_SIGN_EXTEND(raw) ((int32_t) ((uint32_t) (raw) << 8) >> 8)
+
+// one HX711 wired to two pins of GPIOChip1
+struct hx711 {
+    int32_t mem_fd;
+    volatile uint32_t *gpio_addr;
+    volatile uint32_t *setdataout;
+    volatile uint32_t *cleardataout;
+    volatile uint32_t *datain;
+    volatile uint32_t *oe;
+    uint32_t sck_bit;
+    uint32_t dout_bit;     // mask of every DOUT read through this device
+    // line event fd for DOUT falling edges, -1 to busy wait on the register
+    int32_t event_fd;
+    uint32_t event_line;   // DOUT line offset of the event fd, for tracing
+    // total PD_SCK pulses per sample, 25 to 27
+    enum hx711_gain gain;
+};
+
+void hx711_calibrate_delay();
+// several HX711s on one shared PD_SCK with their DOUTs on the same GPIO
+// bank, so one GPIO_DATAIN read per clock edge samples every cell
+#define HX711_MAX_CELLS 16
+struct hx711_array {
+    struct hx711 dev;                    // dev.dout_bit is the mask of all DOUTs
+    uint8_t dout_shift[HX711_MAX_CELLS]; // bit position of each cell's DOUT
+    size_t count;
+};
+
+int32_t hx711_open(struct hx711 *dev, int32_t sck_pin, int32_t dout_pin);
+int32_t hx711_enable_edge_wait(struct hx711 *dev, const char *chip_path, uint32_t line);
+int32_t hx711_wait_ready(struct hx711 *dev, int32_t timeout_ms);
+void hx711_set_gain(struct hx711 *dev, enum hx711_gain gain);
+uint32_t hx711_read(struct hx711 *dev);
+void hx711_close(struct hx711 *dev);
+int32_t hx711_array_open(struct hx711_array *arr, int32_t sck_pin, const int32_t *dout_pins, size_t count);
+void hx711_array_read(struct hx711_array *arr, uint32_t *samples);
+uint32_t hx711_array_busy(struct hx711_array *arr);
+
+#endif
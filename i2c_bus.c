@@ -0,0 +1,213 @@
+// Arbiter of an I2C adapter shared by several slaves.
+// Each slave queues its bytes as segments, a segment being one message and
+// the time the slave needs after it (an HD44780 clear takes 1.52 ms). A
+// flush sends the queues of every slave on the bus in rounds: each round
+// takes the next segment of every slave that is ready and sends them all
+// as one combined I2C_RDWR transfer, starting with a different slave each
+// round so none of them waits behind the others. N panels refreshed
+// together cost one transfer instead of N writes and N waits.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include "i2c_bus.h"
+#include "hal.h"
+#include "trace.h"
+
+static struct i2c_bus buses[I2C_BUS_MAX];
+static int32_t numBuses = 0;
+static pthread_mutex_t busesLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int32_t time_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void time_add_us(struct timespec *t, uint32_t usec) {
+    t->tv_nsec += (long) usec * 1000;
+    while (t->tv_nsec >= 1000000000L) {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+// the bus of the adapter at path, set up on first use. NULL when all
+// I2C_BUS_MAX are taken
+struct i2c_bus *i2c_bus_get(const char *path) {
+    struct i2c_bus *bus = NULL;
+
+    pthread_mutex_lock(&busesLock);
+    for (int32_t b = 0; b < numBuses; b++) {
+        if (strcmp(buses[b].path, path) == 0) {
+            bus = &buses[b];
+        }
+    }
+    if (bus == NULL && numBuses < I2C_BUS_MAX && strlen(path) < I2C_BUS_PATH_SIZE) {
+        bus = &buses[numBuses++];
+        memset(bus, 0, sizeof(*bus));
+        snprintf(bus->path, sizeof(bus->path), "%s", path);
+        pthread_mutex_init(&bus->lock, NULL);
+    }
+    pthread_mutex_unlock(&busesLock);
+    return bus;
+}
+
+// opens the slave at addr and adds client to the bus.
+// returns 0 on success, -1 when the bus is full or the slave can't be opened
+int32_t i2c_bus_attach(struct i2c_bus *bus, struct i2c_client *client, int32_t addr) {
+    int32_t result = -1;
+
+    pthread_mutex_lock(&bus->lock);
+    if (bus->clients < I2C_BUS_MAX_CLIENTS) {
+        memset(client, 0, sizeof(*client));
+        client->bus = bus;
+        client->handle = hal->i2c_open(bus->path, addr);
+        if (client->handle >= 0) {
+            bus->client[bus->clients++] = client;
+            result = 0;
+        }
+    }
+    pthread_mutex_unlock(&bus->lock);
+    return result;
+}
+
+// sends what is still queued for client and removes it from its bus
+void i2c_bus_detach(struct i2c_client *client) {
+    struct i2c_bus *bus = client->bus;
+
+    pthread_mutex_lock(&bus->lock);
+    i2c_bus_flush(bus);
+    for (int32_t c = 0; c < bus->clients; c++) {
+        if (bus->client[c] == client) {
+            bus->client[c] = bus->client[--bus->clients];
+        }
+    }
+    bus->first = 0;
+    hal->i2c_close(client->handle);
+    pthread_mutex_unlock(&bus->lock);
+}
+
+// turns the open bytes into a segment. the callers keep a slot free
+static void i2c_segment_close(struct i2c_client *client, uint32_t wait_us) {
+    struct timespec now;
+
+    if (client->len > client->closed) {
+        struct i2c_segment *segment = &client->segment[client->segments++];
+
+        segment->start = client->closed;
+        segment->len = client->len - client->closed;
+        segment->wait_us = wait_us;
+        client->closed = client->len;
+    } else if (client->segments > client->next) {
+        // nothing new since the last segment, its wait grows instead
+        struct i2c_segment *segment = &client->segment[client->segments - 1];
+
+        segment->wait_us = segment->wait_us > wait_us ? segment->wait_us : wait_us;
+    } else {
+        // nothing queued at all, the wait runs from now
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        time_add_us(&now, wait_us);
+        if (time_before(&client->ready, &now)) {
+            client->ready = now;
+        }
+    }
+}
+
+// queues one byte for client, with its bus locked. a full queue flushes
+// the bus first
+void i2c_client_put(struct i2c_client *client, unsigned char byte) {
+    if (client->len == I2C_CLIENT_BUFFER) {
+        i2c_bus_flush(client->bus);
+    }
+    client->buffer[client->len++] = byte;
+    if (client->len - client->closed == I2C_SEGMENT_MAX) {
+        i2c_client_end(client, 0);
+    }
+}
+
+// ends the message being queued for client, which then needs wait_us
+// before anything else is sent to it. with its bus locked
+void i2c_client_end(struct i2c_client *client, uint32_t wait_us) {
+    i2c_segment_close(client, wait_us);
+    if (client->segments >= I2C_CLIENT_SEGMENTS - 1) {
+        i2c_bus_flush(client->bus);
+    }
+}
+
+// sends everything queued on the bus and returns when every slave can take
+// its next message. with the bus locked
+void i2c_bus_flush(struct i2c_bus *bus) {
+    struct hal_i2c_msg msgs[HAL_I2C_MAX_MSGS];
+    struct i2c_client *served[HAL_I2C_MAX_MSGS];
+    struct timespec now, earliest, latest = { 0, 0 };
+
+    for (int32_t c = 0; c < bus->clients; c++) {
+        i2c_segment_close(bus->client[c], 0);
+    }
+    while (true) {
+        size_t count = 0;
+        bool pending = false;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (int32_t i = 0; i < bus->clients; i++) {
+            struct i2c_client *client = bus->client[(bus->first + i) % bus->clients];
+            struct i2c_segment *segment = &client->segment[client->next];
+
+            if (client->next == client->segments) {
+                continue;
+            }
+            if (time_before(&now, &client->ready)) {
+                if (!pending || time_before(&client->ready, &earliest)) {
+                    earliest = client->ready;
+                }
+                pending = true;
+                continue;
+            }
+            pending = true;
+            if (count == HAL_I2C_MAX_MSGS) {
+                continue;
+            }
+            msgs[count].handle = client->handle;
+            msgs[count].buf = client->buffer + segment->start;
+            msgs[count].len = segment->len;
+            served[count++] = client;
+        }
+        if (!pending) {
+            break;
+        }
+        if (count == 0) {
+            // every slave with data is still busy
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &earliest, NULL) == EINTR);
+            continue;
+        }
+
+        // the bytes go to the trace ring, not stdout, to keep the bus timing
+        for (size_t m = 0; m < count; m++) {
+            trace_i2c(msgs[m].handle, msgs[m].buf, (uint32_t) msgs[m].len);
+        }
+        if (hal->i2c_transfer(msgs, count) != 0) {
+            trace(TRACE_SENSOR_ERROR, (uint16_t) msgs[0].handle, (uint32_t) count);
+        }
+        bus->transfers++;
+        bus->messages += count;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        for (size_t m = 0; m < count; m++) {
+            struct i2c_client *client = served[m];
+
+            client->ready = now;
+            time_add_us(&client->ready, client->segment[client->next++].wait_us);
+        }
+        bus->first = (bus->first + 1) % bus->clients;
+    }
+
+    for (int32_t c = 0; c < bus->clients; c++) {
+        struct i2c_client *client = bus->client[c];
+
+        if (time_before(&latest, &client->ready)) {
+            latest = client->ready;
+        }
+        client->len = client->closed = client->segments = client->next = 0;
+    }
+    // the last messages are still executing when the transfer returns
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &latest, NULL) == EINTR);
+}
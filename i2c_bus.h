@@ -0,0 +1,56 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+#define I2C_BUS_MAX 2                   // i2c-dev adapters in use
+#define I2C_BUS_MAX_CLIENTS 8           // slaves per bus
+#define I2C_BUS_PATH_SIZE 64
+#define I2C_CLIENT_BUFFER 2048          // bytes queued per slave between flushes
+#define I2C_CLIENT_SEGMENTS 32
+#define I2C_SEGMENT_MAX 512             // bytes of one message
+
+// a run of queued bytes sent as one message, and how long the slave needs
+// after it before the next one
+struct i2c_segment {
+    uint32_t start;
+    uint32_t len;
+    uint32_t wait_us;
+};
+
+// one slave on a bus with the bytes queued for it
+struct i2c_client {
+    struct i2c_bus *bus;
+    int32_t handle;                     // hal i2c handle
+    unsigned char buffer[I2C_CLIENT_BUFFER];
+    uint32_t len;                       // bytes queued
+    uint32_t closed;                    // of which in segments, the rest is still open
+    struct i2c_segment segment[I2C_CLIENT_SEGMENTS];
+    uint32_t segments;
+    uint32_t next;                      // first segment not sent yet
+    struct timespec ready;              // when the slave takes the next message
+};
+
+// an adapter shared by every slave on it. all queuing and flushing is done
+// holding lock
+struct i2c_bus {
+    char path[I2C_BUS_PATH_SIZE];
+    pthread_mutex_t lock;
+    struct i2c_client *client[I2C_BUS_MAX_CLIENTS];
+    int32_t clients;
+    int32_t first;                      // client served first in the next round
+    uint64_t transfers;                 // combined transfers sent
+    uint64_t messages;
+};
+
+struct i2c_bus *i2c_bus_get(const char *path);
+int32_t i2c_bus_attach(struct i2c_bus *bus, struct i2c_client *client, int32_t addr);
+void i2c_bus_detach(struct i2c_client *client);
+void i2c_client_put(struct i2c_client *client, unsigned char byte);
+void i2c_client_end(struct i2c_client *client, uint32_t wait_us);
+void i2c_bus_flush(struct i2c_bus *bus);
+
+#endif
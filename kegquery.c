@@ -0,0 +1,165 @@
+// Client of the monitor's query socket, and a load test for it.
+//
+// usage: kegquery [-s socket] [-l seconds] [-c connections] request
+//   request      snapshot | last weight|temperature <keg> <n> |
+//                range weight|temperature <keg> <from_ns> <to_ns>
+//   -s  socket of the monitor (default /tmp/kegmon.sock)
+//   -l  instead of printing the answer, repeat the request for this many
+//       seconds and report the requests per second the monitor sustained
+//   -c  connections kept busy during the load test, one request each in
+//       flight (default 4)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "query.h"
+
+#define MAX_CONNECTIONS QUERY_MAX_CLIENTS
+
+static unsigned char payload[QUERY_PENDING_SIZE];
+
+static double now_s() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int32_t connect_to(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int32_t fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        printf("Error: can't connect to %s, is beerStatus running?\n", path);
+        exit(1);
+    }
+    return fd;
+}
+
+static int32_t read_full(int32_t fd, void *buf, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n = read(fd, (char *) buf + done, len - done);
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t) n;
+    }
+    return 0;
+}
+
+// reads one answer into response and payload. returns 0 on success
+static int32_t receive(int32_t fd, struct query_response *response) {
+    if (read_full(fd, response, sizeof(*response)) != 0 ||
+        (size_t) response->count * response->size > sizeof(payload)) {
+        return -1;
+    }
+    return read_full(fd, payload, (size_t) response->count * response->size);
+}
+
+static void print_answer(const struct query_response *response) {
+    if (response->status != QUERY_OK) {
+        printf("Error: %s\n", response->status == QUERY_UNAVAILABLE ? "not available" : "bad request");
+        return;
+    }
+    for (uint32_t i = 0; i < response->count; i++) {
+        const void *entry = payload + (size_t) i * response->size;
+
+        if (response->type == QUERY_SNAPSHOT) {
+            const struct status_values *v = entry;
+            printf("keg %u: weight %.0f  %.1f%%  %.2f C  health 0x%x\n", i + 1, v->weight, v->percent, v->temperature, v->health);
+        } else if (response->type == QUERY_LAST) {
+            const struct store_record *r = entry;
+            printf("%lld %.3f raw %d%s\n", (long long) r->time_ns, r->value, r->raw, (r->flags & STORE_REJECTED) ? " rejected" : "");
+        } else if (response->type == QUERY_RANGE) {
+            const struct query_aggregate *a = entry;
+            printf("count %llu  min %.3f  max %.3f  mean %.3f  first %.3f  last %.3f  from %lld to %lld\n",
+                   (unsigned long long) a->count, a->min, a->max, a->mean, a->first, a->last,
+                   (long long) a->first_ns, (long long) a->last_ns);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = QUERY_SOCKET_PATH;
+    double seconds = 0;
+    int32_t connections = 4;
+    int32_t fds[MAX_CONNECTIONS];
+    struct query_response response;
+    char request[QUERY_REQUEST_SIZE] = "";
+    size_t used = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:l:c:")) != -1) {
+        if (opt == 's') {
+            path = optarg;
+        } else if (opt == 'l' && atof(optarg) > 0) {
+            seconds = atof(optarg);
+        } else if (opt == 'c' && atoi(optarg) >= 1 && atoi(optarg) <= MAX_CONNECTIONS) {
+            connections = atoi(optarg);
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    for (int32_t i = optind; i < argc; i++) {
+        used += snprintf(request + used, sizeof(request) - used, "%s%s", i > optind ? " " : "", argv[i]);
+    }
+    if (used == 0 || used + 1 >= sizeof(request)) {
+        printf("usage: %s [-s socket] [-l seconds] [-c connections 1-%d] request\n"
+               "  snapshot\n"
+               "  last weight|temperature <keg> <n>\n"
+               "  range weight|temperature <keg> <from_ns> <to_ns>\n", argv[0], MAX_CONNECTIONS);
+        return 1;
+    }
+    request[used++] = '\n';
+
+    if (seconds == 0) {
+        int32_t fd = connect_to(path);
+
+        if (write(fd, request, used) != (ssize_t) used || receive(fd, &response) != 0) {
+            printf("Error: no answer from %s\n", path);
+            return 1;
+        }
+        print_answer(&response);
+        close(fd);
+        return 0;
+    }
+
+    // every connection keeps one request in flight
+    for (int32_t c = 0; c < connections; c++) {
+        fds[c] = connect_to(path);
+    }
+    uint64_t answered = 0;
+    uint64_t bytes = 0;
+    double start = now_s();
+    double end = start + seconds;
+    for (int32_t c = 0; c < connections; c++) {
+        if (write(fds[c], request, used) != (ssize_t) used) {
+            return 1;
+        }
+    }
+    while (now_s() < end) {
+        for (int32_t c = 0; c < connections; c++) {
+            if (receive(fds[c], &response) != 0 || write(fds[c], request, used) != (ssize_t) used) {
+                printf("Error: connection %d dropped\n", c);
+                return 1;
+            }
+            answered++;
+            bytes += sizeof(response) + (size_t) response.count * response.size;
+        }
+    }
+    double elapsed = now_s() - start;
+    printf("%llu requests in %.2f s over %d connections: %.0f requests/s, %.1f us per request, %.0f bytes per answer\n",
+           (unsigned long long) answered, elapsed, connections, answered / elapsed,
+           elapsed / answered * 1e6 * connections, (double) bytes / answered);
+    for (int32_t c = 0; c < connections; c++) {
+        close(fds[c]);
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Prints the keg status a running beerStatus publishes in /dev/shm.
+//
+// usage: kegstatus [-w interval_ms] [-j]
+//   -w  keep printing every interval_ms instead of once
+//   -j  one JSON object per keg and line, for scripts
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "status.h"
+
+static int64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (int64_t) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// seconds since time_ns, or -1 for a time that was never set
+static double age(int64_t now, int64_t time_ns) {
+    return time_ns == 0 ? -1 : (now - time_ns) / 1e9;
+}
+
+static const char *health_text(uint32_t health, char *buf, size_t size) {
+    static const char *names[] = { "weight-missing", "weight-stale", "temperature-missing", "temperature-stale" };
+    size_t used = 0;
+
+    buf[0] = '\0';
+    for (size_t bit = 0; bit < sizeof(names) / sizeof(names[0]); bit++) {
+        if (health & (1u << bit)) {
+            used += snprintf(buf + used, size - used, "%s%s", used > 0 ? "," : "", names[bit]);
+        }
+    }
+    return used > 0 ? buf : "ok";
+}
+
+static void print_status(const struct status_map *map, int32_t json) {
+    int64_t now = now_ns();
+    char buf[96];
+
+    if (!json) {
+        printf("keg     weight  percent   temp C  weight age  temp age  health\n");
+    }
+    for (uint32_t k = 0; k < map->segment->kegs; k++) {
+        struct status_values values;
+        uint64_t sequence;
+        const char *health;
+
+        if (status_read(map, k, &values, &sequence) != 0) {
+            continue;
+        }
+        health = health_text(values.health, buf, sizeof(buf));
+        if (json) {
+            printf("{\"keg\": %u, \"sequence\": %llu, \"weight\": %.1f, \"percent\": %.2f, \"temperature\": %.3f, "
+                   "\"weight_time_ns\": %lld, \"temperature_time_ns\": %lld, \"update_time_ns\": %lld, \"health\": \"%s\"}\n",
+                   k + 1, (unsigned long long) sequence, values.weight, values.percent, values.temperature,
+                   (long long) values.weight_time_ns, (long long) values.temperature_time_ns,
+                   (long long) values.update_time_ns, health);
+        } else {
+            printf("%3u %10.0f %7.1f%% %8.2f %10.1fs %8.1fs  %s\n", k + 1, values.weight, values.percent,
+                   values.temperature, age(now, values.weight_time_ns), age(now, values.temperature_time_ns), health);
+        }
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    struct status_map map;
+    int32_t interval_ms = 0;
+    int32_t json = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:j")) != -1) {
+        if (opt == 'w' && atoi(optarg) > 0) {
+            interval_ms = atoi(optarg);
+        } else if (opt == 'j') {
+            json = 1;
+        } else {
+            printf("usage: %s [-w interval_ms] [-j]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (status_attach(&map) != 0) {
+        printf("Error: no keg status in /dev/shm%s, is beerStatus running?\n", STATUS_SHM_NAME);
+        return 1;
+    }
+    print_status(&map, json);
+    while (interval_ms > 0) {
+        usleep((useconds_t) interval_ms * 1000);
+        print_status(&map, json);
+    }
+    status_detach(&map);
+    return 0;
+}
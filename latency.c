@@ -0,0 +1,105 @@
+// Hot path latency instrumentation of the monitor's tasks.
+// Every periodic task and event source records its wake up latency and
+// handler execution time into its own histograms. Only the owning thread
+// writes a histogram, so recording is a couple of relaxed atomic stores
+// and cheap enough to leave enabled. latency_dump() prints every
+// registered task on demand (SIGUSR1 in the monitor).
+
+#include <stdio.h>
+#include "latency.h"
+
+static struct task_stats *registry[LATENCY_MAX_TASKS];
+static _Atomic uint32_t registered = 0;
+
+// bucket of a value: exact below 8, then 8 sub-buckets per power of two
+static uint32_t bucket_of(uint64_t value) {
+    uint32_t exponent;
+
+    if (value < LATENCY_SUB_BUCKETS) {
+        return (uint32_t) value;
+    }
+    exponent = 63 - (uint32_t) __builtin_clzll(value);
+    return (exponent - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS +
+           (uint32_t) ((value >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// smallest value that lands in bucket
+static uint64_t bucket_floor(uint32_t bucket) {
+    uint32_t exponent;
+
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    exponent = bucket / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    return (uint64_t) (LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (exponent - LATENCY_SUB_BITS);
+}
+
+// adds one value. must only be called by the histogram's owning thread
+void latency_record(struct latency_histogram *h, uint64_t ns) {
+    _Atomic uint64_t *count = &h->counts[bucket_of(ns)];
+
+    atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&h->total, atomic_load_explicit(&h->total, memory_order_relaxed) + 1, memory_order_relaxed);
+    if (ns > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+    }
+}
+
+// value at or below which percentile % of the recorded values fall,
+// reported as the floor of its bucket
+uint64_t latency_percentile(const struct latency_histogram *h, double percentile) {
+    uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);
+    uint64_t target = (uint64_t) (total * percentile / 100.0);
+    uint64_t seen = 0;
+
+    if (total == 0) {
+        return 0;
+    }
+    for (uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += atomic_load_explicit(&h->counts[b], memory_order_relaxed);
+        if (seen > target) {
+            return bucket_floor(b);
+        }
+    }
+    return atomic_load_explicit(&h->max, memory_order_relaxed);
+}
+
+// counts missed deadlines. must only be called by the owning thread
+void latency_miss(struct task_stats *stats, uint64_t misses) {
+    atomic_store_explicit(&stats->deadline_misses,
+                          atomic_load_explicit(&stats->deadline_misses, memory_order_relaxed) + misses,
+                          memory_order_relaxed);
+}
+
+// adds stats to the tasks printed by latency_dump(). called once per task
+// during start up, before the task runs
+void latency_register(struct task_stats *stats, const char *name) {
+    uint32_t slot = atomic_fetch_add(&registered, 1);
+
+    stats->name = name;
+    if (slot < LATENCY_MAX_TASKS) {
+        registry[slot] = stats;
+    }
+}
+
+static void dump_histogram(FILE *out, const char *what, const struct latency_histogram *h) {
+    fprintf(out, "  %-7s n %-8llu p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f us\n", what,
+            (unsigned long long) atomic_load_explicit(&h->total, memory_order_relaxed),
+            latency_percentile(h, 50) / 1e3, latency_percentile(h, 90) / 1e3,
+            latency_percentile(h, 99) / 1e3, latency_percentile(h, 99.9) / 1e3,
+            atomic_load_explicit(&h->max, memory_order_relaxed) / 1e3);
+}
+
+// prints the histograms of every registered task
+void latency_dump(FILE *out) {
+    uint32_t count = atomic_load(&registered);
+
+    for (uint32_t i = 0; i < count && i < LATENCY_MAX_TASKS; i++) {
+        const struct task_stats *stats = registry[i];
+        fprintf(out, "%s  deadline misses %llu\n", stats->name,
+                (unsigned long long) atomic_load_explicit(&stats->deadline_misses, memory_order_relaxed));
+        dump_histogram(out, "wakeup", &stats->wakeup);
+        dump_histogram(out, "exec", &stats->exec);
+    }
+    fflush(out);
+}
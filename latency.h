@@ -0,0 +1,38 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+// HDR style log-linear histogram: 8 linear sub-buckets per power of two,
+// so every recorded value is kept within 12.5% and the whole uint64 range
+// fits in a fixed 496 buckets
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+#define LATENCY_MAX_TASKS 32
+
+// written by a single thread with relaxed atomic stores and read by the
+// dump from any thread, so recording never takes a lock
+struct latency_histogram {
+    _Atomic uint64_t counts[LATENCY_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t max;
+};
+
+// instrumentation of one periodic task or event source
+struct task_stats {
+    const char *name;
+    struct latency_histogram wakeup;     // ns between scheduled release and wake up
+    struct latency_histogram exec;       // ns spent in the handler
+    _Atomic uint64_t deadline_misses;
+};
+
+void latency_record(struct latency_histogram *h, uint64_t ns);
+uint64_t latency_percentile(const struct latency_histogram *h, double percentile);
+void latency_miss(struct task_stats *stats, uint64_t misses);
+void latency_register(struct task_stats *stats, const char *name);
+void latency_dump(FILE *out);
+
+#endif
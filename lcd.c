@@ -19,9 +19,30 @@
 #include <fcntl.h>
 #include<sys/ioctl.h>
 #include<string.h>
+#include <stdbool.h>
+#include "hal.h"
+#include "trace.h"
+#include "i2c_bus.h"
 
 #define I2C_BUS        "/dev/i2c-2" // I2C bus device
 #define I2C_ADDR       0x27         // I2C slave address for the LCD module
+#define LCD_COLS       16           // characters per line of the default display
+#define LCD_ROWS       2            // number of lines of the default display
+#define LCD_MAX_COLS   20
+#define LCD_MAX_ROWS   4
+#define LCD_MAX_DISPLAYS 8
+#define LCD_SET_DDRAM  0x80         // set DDRAM address command
+#define LCD_SET_CGRAM  0x40         // set CGRAM address command
+#define LCD_CLEAR      0x01         // clear display command
+#define LCD_HOME       0x02         // return home command
+#define LCD_EXEC_US    37           // execution time of a data write or command
+#define LCD_HOME_US    1520         // execution time of clear display or return home
+#define LCD_GLYPH_BASE 0x80         // text bytes from here on name a custom glyph
+#define LCD_GLYPH_SLOTS 8           // CGRAM characters, shown by DDRAM codes 8-15
+#define LCD_FULL_BLOCK 0xFF         // all 5x8 pixels set, in the character ROM
+#define LCD_HBAR_1     0            // glyph ids: 1 to 4 columns filled from the left
+#define LCD_VBAR_1     4            // 1 to 7 rows filled from the bottom
+#define LCD_GLYPHS     11
 #define BINARY_FORMAT  " %c  %c  %c  %c  %c  %c  %c  %c\n"
 #define BYTE_TO_BINARY(byte) \
   (byte & 0x80 ? '1' : '0'), \
@@ -34,105 +55,245 @@
   (byte & 0x01 ? '1' : '0') 
 
 static int32_t debug=0;
-int32_t lcd_backlight;
-char address; 
-int32_t i2cFile;
+
+// one HD44780 behind a PCF8574 backpack. its bytes are queued on the
+// arbiter of its bus and sent together with those of the other panels
+// there.
+// each byte written to the PCF8574 becomes its output port state, so the
+// EN high/low pairs and consecutive commands can go back to back: at
+// 100kHz or 400kHz one byte on the bus takes longer than the 37usec the
+// HD44780 needs per write, and only clear/home require an explicit wait
+struct lcd_display {
+   bool open;
+   int32_t cols;
+   int32_t rows;
+   struct i2c_client client;
+   // shadow copy of what the panel currently shows, used to only send the
+   // cells that changed instead of clearing and rewriting the whole screen
+   char shadow[LCD_MAX_ROWS][LCD_MAX_COLS];
+   // DDRAM address the panel cursor is at, -1 when unknown
+   int32_t cursor;
+   // which glyph each CGRAM slot holds, -1 for none. the panel keeps CGRAM
+   // across clears, so a slot is only rewritten when a frame needs a glyph
+   // that isn't loaded
+   int32_t slots[LCD_GLYPH_SLOTS];
+};
+
+static struct lcd_display displays[LCD_MAX_DISPLAYS];
+static pthread_mutex_t displaysLock = PTHREAD_MUTEX_INITIALIZER;
+// the one the i2c_init() / i2c_msg() interface drives
+static struct lcd_display *lcd_default = NULL;
+
+// pixel rows of the custom glyphs, and the ROM character drawn instead when
+// a frame needs more glyphs than there are CGRAM slots
+static const unsigned char lcd_glyph_rows[LCD_GLYPHS][8] = {
+   { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },
+   { 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18 },
+   { 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C },
+   { 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E },
+   { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F },
+   { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x1F },
+   { 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F, 0x1F, 0x1F },
+   { 0x00, 0x00, 0x00, 0x00, 0x1F, 0x1F, 0x1F, 0x1F },
+   { 0x00, 0x00, 0x00, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F },
+   { 0x00, 0x00, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F },
+   { 0x00, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F },
+};
+static const char lcd_glyph_fallback[LCD_GLYPHS] = {
+   ' ', ' ', '|', '|', '_', '_', '_', '_', (char) LCD_FULL_BLOCK, (char) LCD_FULL_BLOCK, (char) LCD_FULL_BLOCK,
+};
+
 unsigned char i2c_ctrl(int32_t backLight,int32_t enable,  int32_t read_write, int32_t register_select);
 void clearDisplay();
 void i2c_init() ;
 void i2c_stop();
-void i2c_send_byte(unsigned char data) ;
 int32_t i2c_msg(const char *str);
+int32_t lcd_update(const char *str);
+void lcd_set_cursor(int32_t row, int32_t col);
+struct lcd_display *lcd_open(const char *bus, int32_t addr, int32_t cols, int32_t rows);
+void lcd_close(struct lcd_display *lcd);
+int32_t lcd_draw(struct lcd_display *lcd, const char *str);
+int32_t lcd_show(struct lcd_display *lcd, const char *str);
+void lcd_clear(struct lcd_display *lcd);
+void lcd_flush();
+int32_t lcd_handle(const struct lcd_display *lcd);
+static void lcd_init(struct lcd_display *lcd);
+static void lcd_send(struct lcd_display *lcd, unsigned char value, int32_t register_select);
+static void lcd_move(struct lcd_display *lcd, int32_t ddram);
+static int32_t lcd_ddram(const struct lcd_display *lcd, int32_t row, int32_t col);
+static void lcd_xfer_byte(struct lcd_display *lcd, unsigned char data);
+static void lcd_xfer_wait(struct lcd_display *lcd, useconds_t usec);
+static void lcd_load_glyphs(struct lcd_display *lcd, char frame[LCD_MAX_ROWS][LCD_MAX_COLS]);
+int32_t lcd_hbar(char *out, int32_t cells, int32_t percent);
+void lcd_vbar(char *top, char *bottom, int32_t percent);
 
+// opens and initializes the 16x2 panel at I2C_ADDR on I2C_BUS
 void i2c_init() {
     if(debug) printf("Init Start:\n");
-    if((i2cFile = open(I2C_BUS, O_RDWR)) < 0) {
-       printf("Error failed to open I2C bus [%s].\n", I2C_BUS);
-       exit(-1);
-    }
-    //set the I2C slave address for all subsequent I2C device transfers
-    if (ioctl(i2cFile, I2C_SLAVE, I2C_ADDR) < 0) {
-       printf("Error failed to set I2C address [%s].\n", I2C_ADDR);
+    if ((lcd_default = lcd_open(I2C_BUS, I2C_ADDR, LCD_COLS, LCD_ROWS)) == NULL) {
        exit(-1);
     }
+    lcd_flush();
+    if(debug) printf("Init End.\n");
+}
+
+// a panel of cols x rows at addr on the I2C adapter bus, e.g. "/dev/i2c-2".
+// the init sequence is queued and goes out with the next lcd_flush(), so
+// several panels initialize in the time of one.
+// returns NULL when the geometry isn't supported or the slave can't be opened
+struct lcd_display *lcd_open(const char *bus, int32_t addr, int32_t cols, int32_t rows) {
+   struct i2c_bus *arbiter = i2c_bus_get(bus);
+   struct lcd_display *lcd = NULL;
+
+   if (arbiter == NULL || cols < 1 || cols > LCD_MAX_COLS || rows < 1 || rows > LCD_MAX_ROWS) {
+      printf("Error unsupported LCD %dx%d on %s.\n", cols, rows, bus);
+      return NULL;
+   }
+   pthread_mutex_lock(&displaysLock);
+   for (int32_t d = 0; d < LCD_MAX_DISPLAYS && lcd == NULL; d++) {
+      if (!displays[d].open) {
+         lcd = &displays[d];
+         lcd->open = true;
+         lcd->client.bus = NULL;
+      }
+   }
+   pthread_mutex_unlock(&displaysLock);
+   if (lcd == NULL) {
+      return NULL;
+   }
+   lcd->cols = cols;
+   lcd->rows = rows;
+   // opens the bus and sets the I2C slave address for all subsequent transfers
+   if (i2c_bus_attach(arbiter, &lcd->client, addr) != 0) {
+      pthread_mutex_lock(&displaysLock);
+      lcd->open = false;
+      pthread_mutex_unlock(&displaysLock);
+      return NULL;
+   }
+   pthread_mutex_lock(&arbiter->lock);
+   lcd_init(lcd);
+   pthread_mutex_unlock(&arbiter->lock);
+   return lcd;
+}
 
-   usleep(15000);             // wait 15msec
-   i2c_send_byte(0b00110100); // D7=0, D6=0, D5=1, D4=1, RS,RW=0 EN=1
-   i2c_send_byte(0b00110000); // D7=0, D6=0, D5=1, D4=1, RS,RW=0 EN=0
-   usleep(4100);              // wait 4.1msec
-   i2c_send_byte(0b00110100); // 
-   i2c_send_byte(0b00110000); // same
-   usleep(100);               // wait 100usec
-   i2c_send_byte(0b00110100); //
-   i2c_send_byte(0b00110000); // 8-bit mode init complete
-   usleep(4100);              // wait 4.1msec
-   i2c_send_byte(0b00100100); //
-   i2c_send_byte(0b00100000); // switched now to 4-bit mode
+// clears the panel and releases it
+void lcd_close(struct lcd_display *lcd) {
+   lcd_clear(lcd);
+   i2c_bus_detach(&lcd->client);
+   pthread_mutex_lock(&displaysLock);
+   lcd->open = false;
+   pthread_mutex_unlock(&displaysLock);
+}
+
+// queues the HD44780 power up sequence, with the bus locked
+static void lcd_init(struct lcd_display *lcd) {
+   // CGRAM holds garbage after power up
+   memset(lcd->slots, -1, sizeof(lcd->slots));
+   lcd_xfer_wait(lcd, 15000);      // wait 15msec
+   lcd_xfer_byte(lcd, 0b00110100); // D7=0, D6=0, D5=1, D4=1, RS,RW=0 EN=1
+   lcd_xfer_byte(lcd, 0b00110000); // D7=0, D6=0, D5=1, D4=1, RS,RW=0 EN=0
+   lcd_xfer_wait(lcd, 4100);       // wait 4.1msec
+   lcd_xfer_byte(lcd, 0b00110100); // 
+   lcd_xfer_byte(lcd, 0b00110000); // same
+   lcd_xfer_wait(lcd, 100);        // wait 100usec
+   lcd_xfer_byte(lcd, 0b00110100); //
+   lcd_xfer_byte(lcd, 0b00110000); // 8-bit mode init complete
+   lcd_xfer_wait(lcd, 4100);       // wait 4.1msec
+   lcd_xfer_byte(lcd, 0b00100100); //
+   lcd_xfer_byte(lcd, 0b00100000); // switched now to 4-bit mode
 
 
    /* -------------------------------------------------------------------- *
     * 4-bit mode initialization complete. Now configuring the function set *
     * -------------------------------------------------------------------- */
-   usleep(40);                // wait 40usec
-   i2c_send_byte(0b00100100); //
-   i2c_send_byte(0b00100000); // keep 4-bit mode
-   i2c_send_byte(0b10000100); //
-   i2c_send_byte(0b10000000); // D3=2lines, D2=char5x8
+   lcd_xfer_byte(lcd, 0b00100100); //
+   lcd_xfer_byte(lcd, 0b00100000); // keep 4-bit mode
+   lcd_xfer_byte(lcd, 0b10000100); //
+   lcd_xfer_byte(lcd, 0b10000000); // D3=2lines, D2=char5x8, 4 line panels too
 
 
    /* -------------------------------------------------------------------- *
     * Next turn display off                                                *
     * -------------------------------------------------------------------- */
-   usleep(40);                // wait 40usec
-   i2c_send_byte(0b00000100); //
-   i2c_send_byte(0b00000000); // D7-D4=0
-   i2c_send_byte(0b10000100); //
-   i2c_send_byte(0b10000000); // D3=1 D2=display_off, D1=cursor_off, D0=cursor_blink
+   lcd_xfer_byte(lcd, 0b00000100); //
+   lcd_xfer_byte(lcd, 0b00000000); // D7-D4=0
+   lcd_xfer_byte(lcd, 0b10000100); //
+   lcd_xfer_byte(lcd, 0b10000000); // D3=1 D2=display_off, D1=cursor_off, D0=cursor_blink
 
 
    /* -------------------------------------------------------------------- *
     * Display clear, cursor home                                           *
     * -------------------------------------------------------------------- */
-      clearDisplay();
+   lcd_send(lcd, LCD_CLEAR, 0);    // D0=display_clear, waits 1.52msec
+   memset(lcd->shadow, ' ', sizeof(lcd->shadow));
+   lcd->cursor = 0;
    /* -------------------------------------------------------------------- *
     * Set cursor direction                                                 *
     * -------------------------------------------------------------------- */
-   usleep(40);                // wait 40usec
-   i2c_send_byte(0b00000100); //
-   i2c_send_byte(0b00000000); // D7-D4=0
-   i2c_send_byte(0b01100100); //
-   i2c_send_byte(0b01100000); // print32_t left to right
+   lcd_xfer_byte(lcd, 0b00000100); //
+   lcd_xfer_byte(lcd, 0b00000000); // D7-D4=0
+   lcd_xfer_byte(lcd, 0b01100100); //
+   lcd_xfer_byte(lcd, 0b01100000); // print32_t left to right
 
 
    /* -------------------------------------------------------------------- *
     * Turn on the display                                                  *
     * -------------------------------------------------------------------- */
-   usleep(40);                // wait 40usec
-   i2c_send_byte(0b00000100); //
-   i2c_send_byte(0b00000000); // D7-D4=0
-   i2c_send_byte(0b11100100); //
-   i2c_send_byte(0b11100000); // D3=1 D2=display_on, D1=cursor_on, D0=cursor_blink
-  if(debug) printf("Init End.\n");
-   sleep(1);
+   lcd_xfer_byte(lcd, 0b00000100); //
+   lcd_xfer_byte(lcd, 0b00000000); // D7-D4=0
+   lcd_xfer_byte(lcd, 0b11100100); //
+   lcd_xfer_byte(lcd, 0b11100000); // D3=1 D2=display_on, D1=cursor_on, D0=cursor_blink
+   i2c_client_end(&lcd->client, LCD_EXEC_US);
 }
 
 
 void i2c_stop() { 
-   clearDisplay();
-   close(i2cFile); 
+   lcd_close(lcd_default);
+   lcd_default = NULL;
    }
 
 
-void i2c_send_byte(unsigned char data) {
-   unsigned char byte[1];
-   byte[0] = data;
-   if(debug) printf(BINARY_FORMAT, BYTE_TO_BINARY(byte[0]));
-   printf("\n");
-   write(i2cFile, byte, sizeof(byte)); 
-   /* -------------------------------------------------------------------- *
-    * Below wait creates 1msec delay, needed by display to catch commands  *
-    * -------------------------------------------------------------------- */
-   usleep(1000);
+// appends one expander byte to the panel's queue on its bus
+static void lcd_xfer_byte(struct lcd_display *lcd, unsigned char data) {
+   i2c_client_put(&lcd->client, data);
+}
+
+// ends the message queued so far, the panel gets usec to finish it before
+// the arbiter sends it anything else. for the points where the datasheet
+// needs the panel to finish before anything else is sent
+static void lcd_xfer_wait(struct lcd_display *lcd, useconds_t usec) {
+   i2c_client_end(&lcd->client, (uint32_t) usec);
+}
+
+// sends what every panel has queued, on every bus, and returns when they
+// are all done with it
+void lcd_flush() {
+   struct i2c_bus *flushed[LCD_MAX_DISPLAYS];
+   int32_t buses = 0;
+
+   pthread_mutex_lock(&displaysLock);
+   for (int32_t d = 0; d < LCD_MAX_DISPLAYS; d++) {
+      struct i2c_bus *bus = displays[d].client.bus;
+      bool seen = !displays[d].open || bus == NULL;
+
+      for (int32_t b = 0; b < buses && !seen; b++) {
+         seen = flushed[b] == bus;
+      }
+      if (!seen) {
+         flushed[buses++] = bus;
+      }
+   }
+   pthread_mutex_unlock(&displaysLock);
+   for (int32_t b = 0; b < buses; b++) {
+      pthread_mutex_lock(&flushed[b]->lock);
+      i2c_bus_flush(flushed[b]);
+      pthread_mutex_unlock(&flushed[b]->lock);
+   }
+}
+
+// the hal i2c handle of the panel
+int32_t lcd_handle(const struct lcd_display *lcd) {
+   return lcd->client.handle;
 }
 
 unsigned char i2c_ctrl(int32_t backLight,int32_t enable,  int32_t read_write, int32_t register_select){
@@ -144,54 +305,213 @@ unsigned char i2c_ctrl(int32_t backLight,int32_t enable,  int32_t read_write, in
     return byte;
 }
 
+// sends one 8-bit value as two 4-bit transfers (upper nibble first),
+// each latched by pulsing EN high then low.
+// register_select = 0 for commands, 1 for character data
+static void lcd_send(struct lcd_display *lcd, unsigned char value, int32_t register_select) {
+   unsigned char upper = value & 0xF0;
+   unsigned char lower = (value << 4) & 0xF0;
+
+   lcd_xfer_byte(lcd, upper | i2c_ctrl(1, 1, 0, register_select)); // EN=1
+   lcd_xfer_byte(lcd, upper | i2c_ctrl(1, 0, 0, register_select)); // EN=0
+   lcd_xfer_byte(lcd, lower | i2c_ctrl(1, 1, 0, register_select)); // EN=1
+   lcd_xfer_byte(lcd, lower | i2c_ctrl(1, 0, 0, register_select)); // EN=0
+
+   // clear display (0x01) and return home (0x02/0x03) take 1.52msec
+   if (register_select == 0 && (value == LCD_CLEAR || (value & 0xFE) == LCD_HOME)) {
+      lcd_xfer_wait(lcd, LCD_HOME_US);
+   }
+}
+
+// DDRAM address of a cell. lines 1 and 2 start at 0x00 and 0x40, and on 4
+// line panels lines 3 and 4 continue them right after the last column
+static int32_t lcd_ddram(const struct lcd_display *lcd, int32_t row, int32_t col) {
+   return (row & 1) * 0x40 + (row >> 1) * lcd->cols + col;
+}
+
+// moves the cursor of the default panel to the given cell through a DDRAM
+// address command
+void lcd_set_cursor(int32_t row, int32_t col) {
+   pthread_mutex_lock(&lcd_default->client.bus->lock);
+   lcd_move(lcd_default, lcd_ddram(lcd_default, row, col));
+   i2c_client_end(&lcd_default->client, LCD_EXEC_US);
+   i2c_bus_flush(lcd_default->client.bus);
+   pthread_mutex_unlock(&lcd_default->client.bus->lock);
+}
+
+// queues a DDRAM address command
+static void lcd_move(struct lcd_display *lcd, int32_t ddram) {
+   lcd_send(lcd, LCD_SET_DDRAM | ddram, 0);
+   lcd->cursor = ddram;
+}
+
+// makes sure every glyph frame uses is in CGRAM and turns the glyph bytes
+// into the DDRAM codes of their slots. a missing glyph goes into a slot
+// this frame doesn't use, so no cell on screen changes under its old code
+// unless it is rewritten anyway. glyphs that don't fit get their fallback
+static void lcd_load_glyphs(struct lcd_display *lcd, char frame[LCD_MAX_ROWS][LCD_MAX_COLS]) {
+   bool needed[LCD_GLYPHS] = {0};
+   bool used[LCD_GLYPH_SLOTS] = {0};
+   int32_t slot_of[LCD_GLYPHS];
+
+   for (int32_t row = 0; row < lcd->rows; row++) {
+      for (int32_t col = 0; col < lcd->cols; col++) {
+         int32_t glyph = (unsigned char) frame[row][col] - LCD_GLYPH_BASE;
+         if (glyph >= 0 && glyph < LCD_GLYPHS) {
+            needed[glyph] = true;
+         }
+      }
+   }
+   for (int32_t glyph = 0; glyph < LCD_GLYPHS; glyph++) {
+      slot_of[glyph] = -1;
+      for (int32_t slot = 0; needed[glyph] && slot < LCD_GLYPH_SLOTS; slot++) {
+         if (lcd->slots[slot] == glyph) {
+            slot_of[glyph] = slot;
+            used[slot] = true;
+         }
+      }
+   }
+   for (int32_t glyph = 0; glyph < LCD_GLYPHS; glyph++) {
+      int32_t slot = 0;
+
+      if (!needed[glyph] || slot_of[glyph] >= 0) {
+         continue;
+      }
+      while (slot < LCD_GLYPH_SLOTS && used[slot]) {
+         slot++;
+      }
+      if (slot == LCD_GLYPH_SLOTS) {
+         break;
+      }
+      lcd_send(lcd, LCD_SET_CGRAM | (slot << 3), 0);
+      for (int32_t i = 0; i < 8; i++) {
+         lcd_send(lcd, lcd_glyph_rows[glyph][i], 1);
+      }
+      lcd->slots[slot] = glyph;
+      slot_of[glyph] = slot;
+      used[slot] = true;
+      // the address counter now points into CGRAM
+      lcd->cursor = -1;
+   }
+
+   for (int32_t row = 0; row < lcd->rows; row++) {
+      for (int32_t col = 0; col < lcd->cols; col++) {
+         int32_t glyph = (unsigned char) frame[row][col] - LCD_GLYPH_BASE;
+         if (glyph >= 0 && glyph < LCD_GLYPHS) {
+            frame[row][col] = slot_of[glyph] >= 0 ? (char) (LCD_GLYPH_SLOTS + slot_of[glyph]) : lcd_glyph_fallback[glyph];
+         }
+      }
+   }
+}
+
+// writes a horizontal bar of cells characters filled to percent into out,
+// five steps per cell. returns cells
+int32_t lcd_hbar(char *out, int32_t cells, int32_t percent) {
+   int32_t filled = (percent * cells * 5 + 50) / 100;
+
+   filled = filled < 0 ? 0 : filled > cells * 5 ? cells * 5 : filled;
+   for (int32_t i = 0; i < cells; i++, filled -= 5) {
+      out[i] = filled >= 5 ? (char) LCD_FULL_BLOCK : filled <= 0 ? ' ' : (char) (LCD_GLYPH_BASE + LCD_HBAR_1 + filled - 1);
+   }
+   return cells;
+}
+
+// the two cells of a vertical bar two lines high filled to percent, eight
+// steps per cell
+void lcd_vbar(char *top, char *bottom, int32_t percent) {
+   int32_t filled = (percent * 16 + 50) / 100;
+   char *cells[2] = { bottom, top };
+
+   filled = filled < 0 ? 0 : filled > 16 ? 16 : filled;
+   for (int32_t i = 0; i < 2; i++, filled -= 8) {
+      *cells[i] = filled >= 8 ? (char) LCD_FULL_BLOCK : filled <= 0 ? ' ' : (char) (LCD_GLYPH_BASE + LCD_VBAR_1 + filled - 1);
+   }
+}
+
+// lays str out on the panel's grid and queues only the cells that differ
+// from the shadow framebuffer, to go out with the next lcd_flush() along
+// with the other panels. text wraps onto the next line after a line's
+// worth of characters or at a '\n', and unused cells are blanked. bytes
+// from LCD_GLYPH_BASE on draw the custom glyphs of lcd_hbar() and
+// lcd_vbar().
+// returns the number of cells that were queued
+int32_t lcd_draw(struct lcd_display *lcd, const char *str) {
+   char frame[LCD_MAX_ROWS][LCD_MAX_COLS];
+   int32_t row = 0, col = 0;
+   int32_t sent = 0;
+
+   memset(frame, ' ', sizeof(frame));
+   for (size_t i = 0; str[i] != '\0' && row < lcd->rows; ++i) {
+      if (str[i] == '\n') {
+         row++;
+         col = 0;
+         continue;
+      }
+      frame[row][col++] = str[i];
+      if (col == lcd->cols) {
+         row++;
+         col = 0;
+      }
+   }
+
+   pthread_mutex_lock(&lcd->client.bus->lock);
+   lcd_load_glyphs(lcd, frame);
+   for (row = 0; row < lcd->rows; row++) {
+      for (col = 0; col < lcd->cols; col++) {
+         if (frame[row][col] == lcd->shadow[row][col]) {
+            continue;
+         }
+         // the panel auto-increments the address after each write, so a run
+         // of changed cells only needs one cursor move
+         if (lcd->cursor != lcd_ddram(lcd, row, col)) {
+            lcd_move(lcd, lcd_ddram(lcd, row, col));
+         }
+         lcd_send(lcd, (unsigned char) frame[row][col], 1);
+         lcd->shadow[row][col] = frame[row][col];
+         lcd->cursor++;
+         sent++;
+      }
+   }
+   // everything that changed goes out as a single message
+   i2c_client_end(&lcd->client, LCD_EXEC_US);
+   pthread_mutex_unlock(&lcd->client.bus->lock);
+   trace(TRACE_LCD_UPDATE, (uint16_t) lcd->client.handle, (uint32_t) sent);
+   return sent;
+}
+
+// lcd_draw() and the flush right after
+int32_t lcd_show(struct lcd_display *lcd, const char *str) {
+   int32_t sent = lcd_draw(lcd, str);
+
+   lcd_flush();
+   return sent;
+}
+
+// the default panel shows str
+int32_t lcd_update(const char *str) {
+   return lcd_show(lcd_default, str);
+}
+
 int32_t i2c_msg(const char *str) {
-   clearDisplay();
-   int32_t enable = 0;
-   if(debug) printf("Writing %s to display\n",str);
-   if(debug) printf("D7 D6 D5 D4 BL EN RW RS\n");
-
-    size_t length = strlen(str);
-    for (size_t i = 0; i < length; ++i) {
-      
-      char mainChar= str[i];
-      char data = (int32_t)mainChar; 
-   
-      // Extract upper 4 bits and lower 4
-      unsigned char upper_4_bits[2];
-      upper_4_bits[0]= data >> 4;
-      upper_4_bits[1]=(data & 0x0F);
-     
-      // Append additional bits to make it 8 bits
-      int32_t additional_bits = 4; // Example: Append 4 bits
-      //Bit manipulation to to move 4 bits to the right and append the bits of data & 0xF
-       enable ^= 1;
-      unsigned char appended_value = (upper_4_bits[0] << additional_bits) |i2c_ctrl(1,enable,0, 1);// first time when enable is 1
-      i2c_send_byte(appended_value);
-
-      enable ^= 1;
-      appended_value = (upper_4_bits[0] << additional_bits) |i2c_ctrl(1,enable,0, 1);//second time when enable is 0
-      i2c_send_byte(appended_value);
-      
-      enable ^=1;
-      //same bit manipulation of lower 4 bits and the ctrl data
-      appended_value = (upper_4_bits[1] << additional_bits) | i2c_ctrl(1,enable,0, 1);//first time when enable is again 1
-      i2c_send_byte(appended_value);
-     
-      enable ^=1;
-      appended_value = (upper_4_bits[1] << additional_bits) | i2c_ctrl(1,enable,0, 1);//when enable is again 0
-      i2c_send_byte(appended_value);
-    }
-    if(debug) printf("Finished writing to display.\n");
+   lcd_update(str);
    return 1;
 }
 
 void clearDisplay(){
+   lcd_clear(lcd_default);
+}
+
+// blanks the panel now
+void lcd_clear(struct lcd_display *lcd) {
+   pthread_mutex_lock(&lcd->client.bus->lock);
    /* -------------------------------------------------------------------- *
     * Display clear, cursor home                                           *
     * -------------------------------------------------------------------- */
-   usleep(40);                // wait 40usec
-   i2c_send_byte(0b00000100); //
-   i2c_send_byte(0b00000000); // D7-D4=0
-   i2c_send_byte(0b00010100); //
-   i2c_send_byte(0b00010000); // D0=display_clear
+   lcd_send(lcd, LCD_CLEAR, 0);    // D0=display_clear, waits 1.52msec
+   i2c_bus_flush(lcd->client.bus);
+
+   // the panel is now blank with the cursor at home
+   memset(lcd->shadow, ' ', sizeof(lcd->shadow));
+   lcd->cursor = 0;
+   pthread_mutex_unlock(&lcd->client.bus->lock);
 }
@@ -8,6 +8,14 @@
 #include<string.h>
 #define I2C_BUS        "/dev/i2c-2" // I2C bus device
 #define I2C_ADDR       0x27         // I2C slave address for the LCD module
+#define LCD_COLS       16           // characters per line of the default display
+#define LCD_ROWS       2            // number of lines of the default display
+#define LCD_MAX_COLS   20
+#define LCD_MAX_ROWS   4
+#define LCD_MAX_DISPLAYS 8
+#define LCD_SET_DDRAM  0x80         // set DDRAM address command
+#define LCD_GLYPH_BASE 0x80         // text bytes from here on name a custom glyph
+#define LCD_FULL_BLOCK 0xFF         // all 5x8 pixels set, in the character ROM
 #define BINARY_FORMAT  " %c  %c  %c  %c  %c  %c  %c  %c\n"
 #define BYTE_TO_BINARY(byte) \
   (byte & 0x80 ? '1' : '0'), \
@@ -19,14 +27,20 @@
   (byte & 0x02 ? '1' : '0'), \
   (byte & 0x01 ? '1' : '0') 
 
-static int32_t debug=0;
-int32_t lcd_backlight;
-static int32_t debug;
-char address; 
-int32_t i2cFile;
 unsigned char i2c_ctrl(int32_t backLight,int32_t enable,  int32_t read_write, int32_t register_select);
 void clearDisplay();
 void i2c_init() ;
 void i2c_stop();
-void i2c_send_byte(unsigned char data) ;
 int32_t i2c_msg(const char *str);
+int32_t lcd_update(const char *str);
+void lcd_set_cursor(int32_t row, int32_t col);
+struct lcd_display;
+struct lcd_display *lcd_open(const char *bus, int32_t addr, int32_t cols, int32_t rows);
+void lcd_close(struct lcd_display *lcd);
+int32_t lcd_draw(struct lcd_display *lcd, const char *str);
+int32_t lcd_show(struct lcd_display *lcd, const char *str);
+void lcd_clear(struct lcd_display *lcd);
+void lcd_flush();
+int32_t lcd_handle(const struct lcd_display *lcd);
+int32_t lcd_hbar(char *out, int32_t cells, int32_t percent);
+void lcd_vbar(char *top, char *bottom, int32_t percent);
@@ -3,114 +3,76 @@
 // Help from GTA Shivani
 // https://www.ti.com/lit/ug/spruh73q/spruh73q.pdf
 // https://github.com/MarkAYoder/BeagleBoard-exercises/blob/d07dc7500beca6a0310f574a36025d23be362631/sensors/mmap/gpioToggle.c
+//
+// usage: load_sensor [-e [gpiochip]] [-g 128|64|32] [-m dout,dout,...]
+//   -e  sleep on DOUT falling edge events from the GPIO character device
+//       (default /dev/gpiochip1) instead of spinning on the data register.
+//       a gpio-sim or gpio-mockup chip can be given to exercise the wait
+//   -g  gain: 128 or 64 on channel A, 32 on channel B (default 128)
+//   -m  read several load cells sharing PD_SCK, one DOUT GPIO per keg
 
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include <sys/mman.h>
 #include <stdlib.h> // for exit() used for testing
+#include <string.h>
+#include "hx711.h"
+
+int main(int argc, char *argv[]) {
+    struct hx711_array cells;
+    struct hx711 *dev = &cells.dev;
+    int32_t dout_pins[HX711_MAX_CELLS] = { DOUT_PIN };
+    size_t count = 1;
+    const char *chip = NULL;
+
+    enum hx711_gain gain = HX711_GAIN_A128;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e::g:m:")) != -1) {
+        if (opt == 'e') {
+            chip = optarg != NULL ? optarg : HX711_GPIOCHIP;
+        } else if (opt == 'g' && atoi(optarg) == 64) {
+            gain = HX711_GAIN_A64;
+        } else if (opt == 'g' && atoi(optarg) == 32) {
+            gain = HX711_GAIN_B32;
+        } else if (opt == 'm') {
+            count = 0;
+            for (char *pin = strtok(optarg, ","); pin != NULL && count < HX711_MAX_CELLS; pin = strtok(NULL, ",")) {
+                dout_pins[count++] = atoi(pin);
+            }
+        } else if (opt != 'g' || atoi(optarg) != 128) {
+            printf("usage: %s [-e [gpiochip]] [-g 128|64|32] [-m dout,dout,...]\n", argv[0]);
+            return -1;
+        }
+    }
 
-#define GPIO_ADDRESS_BASE 0x4804C000  // Base address for GPIO1 registers
-#define GPIO_END_ADDRESS 0x4804D000
-// note: since these GPIOs are on GPIOChip1, bit number = (GPIO Number - 32)
-// ex. GPIO 48 - 32 = 16th bit
-#define PD_SCK_PIN 48                // GPIO number for PD_SCK
-#define DOUT_PIN 49                  // GPIO number for DOUT
-#define PD_SCK_BIT (1 << (PD_SCK_PIN - 32)) // GPIO bit number for PD_SCK (P9_15 or GPIO_48)
-#define DOUT_BIT (1 << (DOUT_PIN - 32))     // GPIO bit number for DOUT (P9_12 or GPIO_60)
-#define BLOCK_SIZE (GPIO_END_ADDRESS - GPIO_ADDRESS_BASE)
-// used for clear and setting the value of output GPIO pins
-#define GPIO_SETDATAOUT 0x194
-#define GPIO_CLEARDATAOUT 0x190
-// used for reading the values of GPIO pins with direction "in" or "out"
-#define GPIO_DATAIN 0x138
-// used for setting a GPIO pin to output or input
-#define GPIO_OE 0x134
-#define WORD_SIZE 4
-
-// global constant for GPIO PATH on BeagleBone Black
-static const char *GPIO_Path = (char *) "/sys/class/gpio/";
-
-int main() {
-    int fd;
-    volatile unsigned int *gpio_addr;
-    volatile unsigned int *gpio_setdataout_addr;
-    volatile unsigned int *gpio_cleardataout_addr;
-    volatile unsigned int *gpio_datain_addr;
-    volatile unsigned int *gpio_oe_addr;
-    unsigned int mem;
-    
-    fd = open("/dev/mem", O_RDWR | O_SYNC);
-
-    if (fd < 0) {
-        perror("Failed to open /dev/mem");
+    if (hx711_array_open(&cells, PD_SCK_PIN, dout_pins, count) != 0) {
         return -1;
     }
+    // the gain applies from the conversion after the next read
+    hx711_set_gain(dev, gain);
 
-    gpio_addr = mmap(NULL, BLOCK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, GPIO_ADDRESS_BASE);
-
-    if (gpio_addr == MAP_FAILED) {
-        perror("Failed to mmap");
-        close(fd);
-        return -2;
+    // without edge events fall back to spinning on DOUT
+    if (chip != NULL && hx711_enable_edge_wait(dev, chip, dout_pins[0] - GPIO_BANK_FIRST) != 0) {
+        printf("Falling back to busy waiting on DOUT\n");
     }
 
-    // initialize necessary gpio memory addresses
-    gpio_setdataout_addr = gpio_addr + GPIO_SETDATAOUT / WORD_SIZE;
-    gpio_cleardataout_addr = gpio_addr + GPIO_CLEARDATAOUT / WORD_SIZE;
-    gpio_datain_addr = gpio_addr + GPIO_DATAIN / WORD_SIZE;
-    gpio_oe_addr = gpio_addr + GPIO_OE / WORD_SIZE;
-
-    // Set PD_SCK_PIN as output and DOUT_PIN as input
-    // note: dereference of gpio_oe_addr is used to get to the values of the physical address
-    mem = *gpio_oe_addr;
-    // printf("GPIO1 configuration: %X\n", mem);
-
-    // set PD_SCK_PIN to output (0)
-    mem &= ~PD_SCK_PIN;
-    *gpio_oe_addr = mem;
-    
-    // // set DOUT_PIN to input (1)
-    mem = *gpio_oe_addr;
-    mem |= DOUT_BIT;
-    *gpio_oe_addr = mem;
-
-    // Configure other GPIO settings   
-    // set SCK_PIN's value to 0
-    *gpio_cleardataout_addr = PD_SCK_BIT;
-
     while (1) {
-        unsigned long data = 0;
-        int i;
+        uint32_t data[HX711_MAX_CELLS];
 
-        // spin while DOUT is HIGH
-        // printf("%X\n", *gpio_datain_addr & DOUT_BIT);
-        while (*gpio_datain_addr & DOUT_BIT) {
-            i++;
+        // wait while any DOUT is HIGH
+        if (hx711_wait_ready(dev, -1) != 0) {
+            continue;
         }
 
-        for (i = 0; i < 24; i++) {
-            // set PD_SCK high
-            *gpio_setdataout_addr = PD_SCK_BIT;
-            // short delay for signal stability
-            usleep(1);
-
-            // Read bit from DOUT
-            // data = (data << 1) | READ_BIT_FROM_DOUT;
-            // printf("%X\n", (*gpio_datain_addr & DOUT_BIT));
-            data = (data << 1) | (*gpio_datain_addr & DOUT_BIT || 0);
-
-            // set PD_SCK low
-            *gpio_cleardataout_addr = PD_SCK_BIT;
-            // short delay for signal stability
-            usleep(1);
-        }
+        hx711_array_read(&cells, data);
         // Use data
-        printf("Weight reading: %lu\n", data);
+        for (size_t c = 0; c < count; c++) {
+            printf("Weight reading %zu: %u (%d)\n", c, data[c], HX711_SIGN_EXTEND(data[c]));
+        }
         sleep(1);  // Sleep for a second
     }
 
-    munmap((void*)gpio_addr, BLOCK_SIZE);
-    close(fd);
+    hx711_close(dev);
     return 0;
 }
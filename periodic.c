@@ -0,0 +1,277 @@
+// Small periodic task runtime used by the monitor threads.
+// Each task gets its own thread that sleeps with clock_nanosleep(TIMER_ABSTIME)
+// until its next release time instead of a relative usleep(), so the period
+// does not drift by the time spent reading a sensor or writing to the LCD.
+//
+// In real-time mode the tasks are created with PTHREAD_EXPLICIT_SCHED so
+// their SCHED_FIFO policy and priority actually apply, tasks marked own_core
+// are pinned to a core the other tasks are kept off, and stacks are fixed
+// size and prefaulted so a locked process never page faults in a period.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "periodic.h"
+#include "trace.h"
+
+#define NSEC_PER_SEC 1000000000L
+#define PERIODIC_STACK_SIZE (256 * 1024) // stack size of real-time task threads
+#define PERIODIC_PREFAULT   (64 * 1024)  // bytes of stack touched before the first period
+
+static void *periodic_thread(void *arg);
+static void prefault_stack();
+static int32_t create_task(struct periodic_task *task, bool realtime, const cpu_set_t *cpus);
+
+// the cores left to everything but the own_core tasks
+static cpu_set_t sharedCpus;
+static bool coresReserved = false;
+
+// adds ms milliseconds to the timespec t
+static void timespec_add_ms(struct timespec *t, uint32_t ms) {
+    t->tv_sec += ms / 1000;
+    t->tv_nsec += (long) (ms % 1000) * 1000000L;
+    if (t->tv_nsec >= NSEC_PER_SEC) {
+        t->tv_sec++;
+        t->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+// nanoseconds from start to end, 0 when end is earlier
+static uint64_t timespec_diff_ns(const struct timespec *start, const struct timespec *end) {
+    int64_t ns = (int64_t) (end->tv_sec - start->tv_sec) * NSEC_PER_SEC + (end->tv_nsec - start->tv_nsec);
+    return ns > 0 ? (uint64_t) ns : 0;
+}
+
+// returns non-zero when a is later than b
+static int32_t timespec_after(const struct timespec *a, const struct timespec *b) {
+    if (a->tv_sec != b->tv_sec) {
+        return a->tv_sec > b->tv_sec;
+    }
+    return a->tv_nsec > b->tv_nsec;
+}
+
+static void *periodic_thread(void *arg) {
+    struct periodic_task *task = arg;
+    struct timespec next, woke, now;
+
+    printf("Process ID of %s Thread is : %lu\n", task->name, (unsigned long) pthread_self());
+    prefault_stack();
+    trace_thread(task->name);
+    if (task->init != NULL) {
+        task->init(task->arg);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (1) {
+        timespec_add_ms(&next, task->period_ms);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+            // interrupted by a signal, sleep again until the same deadline
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &woke);
+        task->handler(task->arg);
+        task->releases++;
+
+        // the deadline of a release is the start of the next one
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        latency_record(&task->stats.wakeup, timespec_diff_ns(&next, &woke));
+        latency_record(&task->stats.exec, timespec_diff_ns(&woke, &now));
+        struct timespec deadline = next;
+        timespec_add_ms(&deadline, task->period_ms);
+        if (timespec_after(&now, &deadline)) {
+            task->missed_deadlines++;
+            latency_miss(&task->stats, 1);
+            // drop the releases that already passed instead of running the
+            // handler back to back to catch up
+            while (timespec_after(&now, &deadline)) {
+                next = deadline;
+                timespec_add_ms(&deadline, task->period_ms);
+                task->skipped_releases++;
+            }
+        }
+    }
+    return NULL;
+}
+
+// touches the top of the thread's stack so its pages are mapped (and, with
+// mlockall, locked) before the task's first release
+static void prefault_stack() {
+    volatile unsigned char stack[PERIODIC_PREFAULT];
+    const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+
+    // one store per page through the volatile array, a memset of it with
+    // the qualifier cast away is dropped by the optimizer
+    for (size_t i = 0; i < sizeof(stack); i += page) {
+        stack[i] = 0;
+    }
+    stack[sizeof(stack) - 1] = 0;
+}
+
+// locks all current and future pages of the process into RAM.
+// returns 0 on success, otherwise the errno of mlockall
+int32_t periodic_lock_memory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        int32_t err = errno;
+        printf("Warning: mlockall failed (%s), memory is not locked\n", strerror(err));
+        return err;
+    }
+    return 0;
+}
+
+// creates the thread of a single task. in real-time mode the SCHED_FIFO
+// policy and priority are set explicitly instead of inherited, and cpus
+// (when not NULL) restricts the cores the thread may run on
+static int32_t create_task(struct periodic_task *task, bool realtime, const cpu_set_t *cpus) {
+    pthread_attr_t attr;
+    struct sched_param param = {0};
+    int32_t result;
+
+    if (pthread_attr_init(&attr) != 0) {
+        return EINVAL;
+    }
+    if (realtime) {
+        param.sched_priority = task->priority;
+        result = pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        if (result == 0) {
+            result = pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        }
+        if (result == 0) {
+            result = pthread_attr_setschedparam(&attr, &param);
+        }
+        if (result == 0) {
+            result = pthread_attr_setstacksize(&attr, PERIODIC_STACK_SIZE);
+        }
+        if (result == 0 && cpus != NULL) {
+            result = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), cpus);
+        }
+        if (result != 0) {
+            pthread_attr_destroy(&attr);
+            return result;
+        }
+    }
+    result = pthread_create(&task->thread, &attr, periodic_thread, task);
+    pthread_attr_destroy(&attr);
+    return result;
+}
+
+// hands out the dedicated cores of the own_core tasks, from the top down
+// keeping at least core 0 for everything else, and moves the calling
+// thread onto the remaining cores. threads inherit the affinity of their
+// creator, so called before any other thread is created it keeps every
+// thread but the own_core tasks off their cores
+void periodic_reserve_cores(struct periodic_task *tasks, size_t count, bool realtime) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int32_t next_core = (int32_t) online - 1;
+    bool reserved = false;
+    int32_t err;
+
+    CPU_ZERO(&sharedCpus);
+    for (int32_t c = 0; c < online && c < CPU_SETSIZE; c++) {
+        CPU_SET(c, &sharedCpus);
+    }
+    for (size_t i = 0; i < count; i++) {
+        tasks[i].cpu = -1;
+        if (realtime && tasks[i].own_core) {
+            if (next_core > 0) {
+                tasks[i].cpu = next_core;
+                CPU_CLR(next_core, &sharedCpus);
+                next_core--;
+                reserved = true;
+            } else {
+                printf("Warning: no spare core to pin %s to\n", tasks[i].name);
+            }
+        }
+    }
+    coresReserved = true;
+
+    err = reserved ? pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &sharedCpus) : 0;
+    if (err != 0) {
+        printf("Warning: could not keep the other threads off the dedicated cores (%s)\n", strerror(err));
+    }
+}
+
+// creates one thread per task. with realtime set the tasks run under
+// SCHED_FIFO with their table priority and own_core tasks get a dedicated
+// core, reserved here unless periodic_reserve_cores() already did. when the
+// real-time attributes can't be applied, for lack of RT privileges or
+// otherwise, the task falls back to normal scheduling and this is reported.
+// returns 0 on success, otherwise the index of the task that failed plus one
+int32_t periodic_start(struct periodic_task *tasks, size_t count, bool realtime) {
+    if (!coresReserved) {
+        periodic_reserve_cores(tasks, count, realtime);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct periodic_task *task = &tasks[i];
+        cpu_set_t own;
+        const cpu_set_t *cpus = &sharedCpus;
+        int32_t result;
+
+        task->releases = 0;
+        task->missed_deadlines = 0;
+        task->skipped_releases = 0;
+        task->realtime = false;
+        latency_register(&task->stats, task->name);
+
+        if (task->cpu >= 0) {
+            CPU_ZERO(&own);
+            CPU_SET(task->cpu, &own);
+            cpus = &own;
+        }
+
+        result = create_task(task, realtime, cpus);
+        if (result == EPERM && realtime) {
+            printf("Warning: no real-time privileges for %s, falling back to normal scheduling\n", task->name);
+        } else if (result != 0 && realtime) {
+            printf("Warning: real-time attributes of %s not applied (%s), falling back to normal scheduling\n",
+                   task->name, strerror(result));
+        }
+        if (result != 0 && realtime) {
+            task->cpu = -1;
+            result = create_task(task, false, NULL);
+        }
+        if (result != 0) {
+            printf("Error creating %s thread (%s)\n", task->name, strerror(result));
+            return (int32_t) i + 1;
+        }
+
+        // check what the kernel actually applied rather than trusting the attributes
+        if (realtime) {
+            struct sched_param param;
+            int32_t policy;
+            if (pthread_getschedparam(task->thread, &policy, &param) == 0 &&
+                policy == SCHED_FIFO && param.sched_priority == task->priority) {
+                task->realtime = true;
+            } else {
+                printf("Warning: %s is not running under SCHED_FIFO priority %d\n", task->name, task->priority);
+            }
+        }
+    }
+    return 0;
+}
+
+void periodic_join(struct periodic_task *tasks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(tasks[i].thread, NULL);
+    }
+}
+
+// prints the release and deadline statistics of every task
+void periodic_report(const struct periodic_task *tasks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        printf("%-20s period %5u ms  %s prio %d cpu %d  releases %llu  missed %llu  skipped %llu\n",
+               tasks[i].name, tasks[i].period_ms,
+               tasks[i].realtime ? "SCHED_FIFO" : "SCHED_OTHER", tasks[i].priority, tasks[i].cpu,
+               (unsigned long long) tasks[i].releases,
+               (unsigned long long) tasks[i].missed_deadlines,
+               (unsigned long long) tasks[i].skipped_releases);
+    }
+}
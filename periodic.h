@@ -0,0 +1,37 @@
+#ifndef PERIODIC_H
+#define PERIODIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "latency.h"
+
+// one entry of the periodic task table. the runtime releases the handler
+// every period_ms on absolute CLOCK_MONOTONIC deadlines, so the time spent
+// inside the handler does not shift the next release
+struct periodic_task {
+    const char *name;
+    uint32_t period_ms;
+    int32_t priority;                  // SCHED_FIFO priority, higher runs first
+    bool own_core;                     // in real-time mode, pin to a core no other task uses
+    void (*init)(void *arg);           // optional, run once on the task's thread
+    void (*handler)(void *arg);        // run once per period
+    void *arg;
+
+    // filled in by the runtime
+    pthread_t thread;
+    uint64_t releases;                 // number of times the handler ran
+    uint64_t missed_deadlines;         // handler finished after its next release
+    uint64_t skipped_releases;         // releases dropped to catch up after a miss
+    bool realtime;                     // SCHED_FIFO was verified on the running thread
+    int32_t cpu;                       // core the task is pinned to, -1 when not pinned
+    struct task_stats stats;           // wake up and execution time histograms
+};
+
+int32_t periodic_lock_memory();
+void periodic_reserve_cores(struct periodic_task *tasks, size_t count, bool realtime);
+int32_t periodic_start(struct periodic_task *tasks, size_t count, bool realtime);
+void periodic_join(struct periodic_task *tasks, size_t count);
+void periodic_report(const struct periodic_task *tasks, size_t count);
+
+#endif
@@ -0,0 +1,374 @@
+// Query server on a Unix domain socket, for processes that want more than
+// the shared memory status: the recent samples of a keg or an aggregate
+// over a time range. Clients are served from the monitor's event loop
+// through a second epoll fd holding the listening socket and every
+// connection, so there is no thread per client and a slow client can't
+// hold up the sensors. "last" answers point writev() straight at the
+// records in the store's mapped segments; only a response the socket
+// can't take at once is copied, so it survives until the client drains it.
+// A "range" request reads a few segments per pass of the loop, so a scan
+// over the whole retention window doesn't stall the other sources.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "query.h"
+
+// epoll data of the listening socket, clients use their slot index
+#define QUERY_LISTENER QUERY_MAX_CLIENTS
+
+static void query_dispatch(struct event_source *source);
+
+static void query_close_client(struct query_server *server, struct query_client *client) {
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    client->fd = -1;
+}
+
+// waits for the socket to drain a pending response or for more requests
+static void query_watch(struct query_server *server, struct query_client *client, uint32_t events) {
+    struct epoll_event ev = { .events = events };
+
+    ev.data.u32 = (uint32_t) (client - server->clients);
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev);
+}
+
+// sends a response in one writev. whatever the socket doesn't take is
+// copied to the client's pending buffer. returns -1 if the client is gone
+static int32_t query_send(struct query_server *server, struct query_client *client, struct iovec *iov, int32_t count) {
+    ssize_t sent = writev(client->fd, iov, count);
+
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return -1;
+    }
+    if (sent < 0) {
+        sent = 0;
+    }
+    for (int32_t i = 0; i < count; i++) {
+        size_t skip = (size_t) sent < iov[i].iov_len ? (size_t) sent : iov[i].iov_len;
+
+        sent -= (ssize_t) skip;
+        memcpy(client->pending + client->pending_len, (char *) iov[i].iov_base + skip, iov[i].iov_len - skip);
+        client->pending_len += iov[i].iov_len - skip;
+    }
+    if (client->pending_len > 0) {
+        client->pending_sent = 0;
+        query_watch(server, client, EPOLLOUT);
+    }
+    return 0;
+}
+
+static int32_t query_error(struct query_server *server, struct query_client *client, enum query_type type, enum query_status status) {
+    struct query_response response = { .status = status, .type = type };
+    struct iovec iov = { &response, sizeof(response) };
+
+    return query_send(server, client, &iov, 1);
+}
+
+static struct sample_store *query_stream(struct query_server *server, const char *name) {
+    if (strcmp(name, "weight") == 0) {
+        return server->backend.weight;
+    }
+    if (strcmp(name, "temperature") == 0) {
+        return server->backend.temperature;
+    }
+    return NULL;
+}
+
+static int32_t query_snapshot(struct query_server *server, struct query_client *client) {
+    const struct status_map *status = server->backend.status;
+    struct status_values values[STATUS_MAX_KEGS];
+    struct query_response response = { .status = QUERY_OK, .type = QUERY_SNAPSHOT, .size = sizeof(values[0]) };
+    struct iovec iov[2];
+    uint64_t sequence;
+
+    if (status == NULL || status->segment == NULL) {
+        return query_error(server, client, QUERY_SNAPSHOT, QUERY_UNAVAILABLE);
+    }
+    // the entries change under the seqlock, so these few are copied
+    while (response.count < status->segment->kegs && status_read(status, response.count, &values[response.count], &sequence) == 0) {
+        response.count++;
+    }
+    iov[0] = (struct iovec) { &response, sizeof(response) };
+    iov[1] = (struct iovec) { values, response.count * sizeof(values[0]) };
+    return query_send(server, client, iov, 2);
+}
+
+static int32_t query_last(struct query_server *server, struct query_client *client, struct sample_store *store, uint32_t keg, size_t n) {
+    static const struct store_record *records[QUERY_MAX_SAMPLES];
+    static struct iovec iov[QUERY_MAX_SAMPLES + 1];
+    struct query_response response = { .status = QUERY_OK, .type = QUERY_LAST, .size = sizeof(struct store_record) };
+    int32_t count = 1;
+
+    if (n > QUERY_MAX_SAMPLES) {
+        n = QUERY_MAX_SAMPLES;
+    }
+    response.count = (uint32_t) store_latest(store, (uint16_t) keg, n, records);
+    iov[0] = (struct iovec) { &response, sizeof(response) };
+    // records next to each other in the segment go out as one iovec
+    for (uint32_t i = 0; i < response.count; i++) {
+        if (count > 1 && (const char *) iov[count - 1].iov_base + iov[count - 1].iov_len == (const char *) records[i]) {
+            iov[count - 1].iov_len += sizeof(struct store_record);
+        } else {
+            iov[count++] = (struct iovec) { (void *) records[i], sizeof(struct store_record) };
+        }
+    }
+    return query_send(server, client, iov, count);
+}
+
+static void query_range_visit(const struct store_record *record, void *arg) {
+    struct query_scan *scan = arg;
+    struct query_aggregate *a = &scan->aggregate;
+
+    if (record->keg != scan->keg || (record->flags & STORE_REJECTED)) {
+        return;
+    }
+    if (a->count == 0) {
+        a->first = record->value;
+        a->first_ns = record->time_ns;
+    }
+    a->min = record->value < a->min ? record->value : a->min;
+    a->max = record->value > a->max ? record->value : a->max;
+    a->mean += record->value;
+    a->last = record->value;
+    a->last_ns = record->time_ns;
+    a->count++;
+}
+
+// reads the next segments of the client's range request and answers it
+// once they are all read. until then the client waits for EPOLLOUT, which
+// a socket with room reports right away, so the scan goes on in the next
+// pass of the loop after the other sources had their turn
+static int32_t query_range_step(struct query_server *server, struct query_client *client) {
+    struct query_scan *scan = &client->scan;
+    struct query_response response = { .status = QUERY_OK, .type = QUERY_RANGE, .count = 1, .size = sizeof(scan->aggregate) };
+    struct iovec iov[2];
+
+    if (store_scan_step(scan->store, &scan->cursor, scan->from_ns, scan->to_ns, QUERY_SCAN_SEGMENTS,
+                        query_range_visit, scan) != 0) {
+        query_watch(server, client, EPOLLOUT);
+        return 0;
+    }
+    scan->store = NULL;
+    query_watch(server, client, EPOLLIN);
+    if (scan->aggregate.count > 0) {
+        scan->aggregate.mean /= (double) scan->aggregate.count;
+    } else {
+        scan->aggregate.min = scan->aggregate.max = 0;
+    }
+    iov[0] = (struct iovec) { &response, sizeof(response) };
+    iov[1] = (struct iovec) { &scan->aggregate, sizeof(scan->aggregate) };
+    return query_send(server, client, iov, 2);
+}
+
+static int32_t query_range(struct query_server *server, struct query_client *client, struct sample_store *store,
+                           uint32_t keg, int64_t from_ns, int64_t to_ns) {
+    client->scan = (struct query_scan) {
+        .store = store,
+        .from_ns = from_ns,
+        .to_ns = to_ns,
+        .keg = (uint16_t) keg,
+        .aggregate = { .min = DBL_MAX, .max = -DBL_MAX },
+    };
+    return query_range_step(server, client);
+}
+
+// answers one request line. returns -1 when the client should be dropped
+static int32_t query_answer(struct query_server *server, struct query_client *client, const char *line) {
+    char command[16], stream[16];
+    struct sample_store *store;
+    unsigned int keg;
+    long long a, b;
+    int32_t fields = sscanf(line, "%15s %15s %u %lld %lld", command, stream, &keg, &a, &b);
+
+    server->requests++;
+    if (fields >= 1 && strcmp(command, "snapshot") == 0) {
+        return query_snapshot(server, client);
+    }
+    if (fields >= 4 && strcmp(command, "last") == 0 && keg >= 1 && keg <= STORE_MAX_KEGS && a > 0) {
+        store = query_stream(server, stream);
+        return store == NULL ? query_error(server, client, QUERY_LAST, QUERY_UNAVAILABLE)
+                             : query_last(server, client, store, keg - 1, (size_t) a);
+    }
+    if (fields == 5 && strcmp(command, "range") == 0 && keg >= 1 && keg <= STORE_MAX_KEGS) {
+        store = query_stream(server, stream);
+        return store == NULL ? query_error(server, client, QUERY_RANGE, QUERY_UNAVAILABLE)
+                             : query_range(server, client, store, keg - 1, a, b);
+    }
+    return query_error(server, client, 0, QUERY_BAD_REQUEST);
+}
+
+// answers the complete lines received so far, stopping while a response
+// is still pending or a range is being read so a client can't make the
+// monitor buffer without bound
+static int32_t query_process(struct query_server *server, struct query_client *client) {
+    char *newline;
+
+    while (client->pending_len == 0 && client->scan.store == NULL && (newline = memchr(client->request, '\n', client->used)) != NULL) {
+        size_t length = (size_t) (newline - client->request) + 1;
+
+        *newline = '\0';
+        if (query_answer(server, client, client->request) != 0) {
+            return -1;
+        }
+        client->used -= length;
+        memmove(client->request, client->request + length, client->used);
+    }
+    // a line longer than the buffer is not a request
+    return client->used == sizeof(client->request) ? -1 : 0;
+}
+
+static int32_t query_receive(struct query_server *server, struct query_client *client) {
+    for (;;) {
+        ssize_t len = read(client->fd, client->request + client->used, sizeof(client->request) - client->used);
+
+        if (len == 0) {
+            return -1;
+        }
+        if (len < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        client->used += (size_t) len;
+        if (query_process(server, client) != 0) {
+            return -1;
+        }
+        if (client->pending_len > 0 || client->scan.store != NULL) {
+            return 0;
+        }
+    }
+}
+
+// sends more of a pending response, then goes back to reading requests
+static int32_t query_drain(struct query_server *server, struct query_client *client) {
+    ssize_t sent = write(client->fd, client->pending + client->pending_sent, client->pending_len - client->pending_sent);
+
+    if (sent < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    client->pending_sent += (size_t) sent;
+    if (client->pending_sent < client->pending_len) {
+        return 0;
+    }
+    client->pending_len = 0;
+    query_watch(server, client, EPOLLIN);
+    return query_process(server, client);
+}
+
+static void query_accept(struct query_server *server) {
+    int32_t fd;
+
+    while ((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        struct query_client *client = NULL;
+        struct epoll_event ev = { .events = EPOLLIN };
+
+        for (size_t i = 0; i < QUERY_MAX_CLIENTS && client == NULL; i++) {
+            if (server->clients[i].fd < 0) {
+                client = &server->clients[i];
+            }
+        }
+        if (client == NULL) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->used = 0;
+        client->pending_len = 0;
+        client->scan.store = NULL;
+        ev.data.u32 = (uint32_t) (client - server->clients);
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            client->fd = -1;
+        }
+    }
+}
+
+// handles whatever is ready on the server's epoll fd, without blocking
+static void query_dispatch(struct event_source *source) {
+    struct query_server *server = source->arg;
+    struct epoll_event events[QUERY_MAX_CLIENTS + 1];
+    int32_t n = epoll_wait(server->epoll_fd, events, QUERY_MAX_CLIENTS + 1, 0);
+
+    for (int32_t i = 0; i < n; i++) {
+        struct query_client *client;
+        int32_t result = 0;
+
+        if (events[i].data.u32 == QUERY_LISTENER) {
+            query_accept(server);
+            continue;
+        }
+        client = &server->clients[events[i].data.u32];
+        if (client->fd < 0) {
+            continue;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            result = -1;
+        } else if (client->pending_len > 0) {
+            result = query_drain(server, client);
+        } else if (client->scan.store != NULL) {
+            result = query_range_step(server, client);
+            // answered, go on with the lines that came in meanwhile
+            if (result == 0 && client->scan.store == NULL && client->pending_len == 0) {
+                result = query_process(server, client);
+            }
+        } else {
+            result = query_receive(server, client);
+        }
+        if (result != 0) {
+            query_close_client(server, client);
+        }
+    }
+}
+
+// listens on path and adds the server to loop. returns 0 on success
+int32_t query_start(struct query_server *server, struct event_loop *loop, const char *path, const struct query_backend *backend) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    memset(server, 0, sizeof(*server));
+    server->backend = *backend;
+    for (size_t i = 0; i < QUERY_MAX_CLIENTS; i++) {
+        server->clients[i].fd = -1;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->listen_fd < 0 || server->epoll_fd < 0) {
+        printf("Error creating query server: %s\n", strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    if (bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(server->listen_fd, QUERY_MAX_CLIENTS) != 0) {
+        printf("Error listening on %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    ev.data.u32 = QUERY_LISTENER;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &ev) != 0) {
+        return -1;
+    }
+
+    server->source.name = "queryServer";
+    server->source.handler = query_dispatch;
+    server->source.arg = server;
+    return event_loop_add_fd(loop, &server->source, server->epoll_fd, EPOLLIN) == 0 ? 0 : -1;
+}
+
+// closes every connection and removes the socket
+void query_stop(struct query_server *server, const char *path) {
+    for (size_t i = 0; i < QUERY_MAX_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) {
+            close(server->clients[i].fd);
+            server->clients[i].fd = -1;
+        }
+    }
+    close(server->listen_fd);
+    close(server->epoll_fd);
+    unlink(path);
+}
@@ -0,0 +1,96 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "event_loop.h"
+#include "status.h"
+#include "store.h"
+
+#define QUERY_SOCKET_PATH "/tmp/kegmon.sock"
+#define QUERY_MAX_CLIENTS 16
+#define QUERY_MAX_SAMPLES 1000          // most records one "last" request returns, below IOV_MAX
+#define QUERY_REQUEST_SIZE 128          // longest request line
+#define QUERY_PENDING_SIZE (sizeof(struct query_response) + QUERY_MAX_SAMPLES * sizeof(struct store_record))
+#define QUERY_SCAN_SEGMENTS 2           // segments a range request reads per event loop pass
+
+// requests are text lines, keg numbers start at 1:
+//   snapshot
+//   last weight|temperature <keg> <n>
+//   range weight|temperature <keg> <from_ns> <to_ns>
+// every answer is a query_response followed by count entries of size bytes
+enum query_type {
+    QUERY_SNAPSHOT = 1,         // entries: struct status_values, one per keg
+    QUERY_LAST,                 // entries: struct store_record, oldest first
+    QUERY_RANGE,                // entry: struct query_aggregate
+};
+
+enum query_status {
+    QUERY_OK = 0,
+    QUERY_BAD_REQUEST,
+    QUERY_UNAVAILABLE,          // the monitor runs without that data
+};
+
+struct query_response {
+    uint32_t status;
+    uint32_t type;
+    uint32_t count;
+    uint32_t size;
+};
+
+// summary of one keg's stream between two CLOCK_REALTIME times
+struct query_aggregate {
+    uint64_t count;
+    double min;
+    double max;
+    double mean;
+    double first;
+    double last;
+    int64_t first_ns;
+    int64_t last_ns;
+};
+
+// what the answers are served from. any of them may be NULL
+struct query_backend {
+    const struct status_map *status;
+    struct sample_store *weight;
+    struct sample_store *temperature;
+};
+
+// a range request being answered, QUERY_SCAN_SEGMENTS at a time
+struct query_scan {
+    struct sample_store *store; // NULL when no scan is running
+    int64_t from_ns;
+    int64_t to_ns;
+    uint16_t keg;
+    struct store_scan_cursor cursor;
+    struct query_aggregate aggregate;
+};
+
+struct query_client {
+    int32_t fd;                 // -1 for a free slot
+    char request[QUERY_REQUEST_SIZE];
+    size_t used;
+    // the part of a response the socket did not take, copied out because
+    // the records it points at may be unmapped before it drains
+    unsigned char pending[QUERY_PENDING_SIZE];
+    size_t pending_len;
+    size_t pending_sent;
+    struct query_scan scan;
+};
+
+// listening socket and clients share one epoll fd, which is a single
+// source of the monitor's event loop
+struct query_server {
+    int32_t listen_fd;
+    int32_t epoll_fd;
+    struct event_source source;
+    struct query_backend backend;
+    struct query_client clients[QUERY_MAX_CLIENTS];
+    uint64_t requests;
+};
+
+int32_t query_start(struct query_server *server, struct event_loop *loop, const char *path, const struct query_backend *backend);
+void query_stop(struct query_server *server, const char *path);
+
+#endif
@@ -0,0 +1,49 @@
+// Seqlock publication of the shared sensor values.
+// Replaces weight_mutex and temperature_mutex: a low priority reader such as
+// the display can no longer hold a lock the high priority sampler needs.
+
+#include <string.h>
+#include "sensor_state.h"
+
+// stores a new sample. must only be called from the record's writer task
+void sensor_publish(struct sensor_record *record, double value) {
+    uint32_t lock = atomic_load_explicit(&record->lock, memory_order_relaxed);
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // mark the record as being written before touching the data
+    atomic_store_explicit(&record->lock, lock + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    record->value = value;
+    record->time = now;
+    record->sequence++;
+
+    // publish the data together with the even lock value
+    atomic_store_explicit(&record->lock, lock + 2, memory_order_release);
+}
+
+// copies the record, retrying while a write overlaps the copy
+void sensor_read(const struct sensor_record *record, struct sensor_reading *out) {
+    uint32_t before, after;
+
+    do {
+        before = atomic_load_explicit(&record->lock, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        out->value = record->value;
+        out->time = record->time;
+        out->sequence = record->sequence;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&record->lock, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+// copies every sensor's latest reading. each reading is internally
+// consistent, and none of the readers can delay a writer
+void sensor_snapshot(const struct sensor_state *state, struct sensor_snapshot *out) {
+    sensor_read(&state->weight, &out->weight);
+    sensor_read(&state->temperature, &out->temperature);
+}
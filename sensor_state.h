@@ -0,0 +1,41 @@
+#ifndef SENSOR_STATE_H
+#define SENSOR_STATE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// latest value of one sensor, published through a seqlock.
+// each record has exactly one writer (the task sampling that sensor), so
+// writers never wait, and readers retry instead of taking a lock
+struct sensor_record {
+    _Atomic uint32_t lock;      // odd while the writer is updating the record
+    double value;
+    struct timespec time;       // CLOCK_MONOTONIC time of the sample
+    uint64_t sequence;          // number of samples published so far
+};
+
+// all shared sensor values of the monitor
+struct sensor_state {
+    struct sensor_record weight;
+    struct sensor_record temperature;
+};
+
+// consistent copy of one sensor_record
+struct sensor_reading {
+    double value;
+    struct timespec time;
+    uint64_t sequence;          // 0 until the first sample is published
+};
+
+// what readers (LCD, logging, export) work with
+struct sensor_snapshot {
+    struct sensor_reading weight;
+    struct sensor_reading temperature;
+};
+
+void sensor_publish(struct sensor_record *record, double value);
+void sensor_read(const struct sensor_record *record, struct sensor_reading *out);
+void sensor_snapshot(const struct sensor_state *state, struct sensor_snapshot *out);
+
+#endif
@@ -0,0 +1,162 @@
+// Compressed encoding of a sensor series, in the style of Facebook's
+// Gorilla. Samples arrive on a fixed period and the readings change
+// slowly, so a timestamp is stored as the change of its delta to the
+// previous one (almost always 0, one bit) and a reading as the zigzag
+// coded difference to the previous one, which for a 24-bit HX711 count is
+// within the sample noise. Both go through the same four bucket prefix
+// code. Readings are integers (raw counts, millidegrees) so there is no
+// floating point XOR step and decoding is exact.
+
+#include <string.h>
+#include "series.h"
+
+struct bucket {
+    uint32_t prefix;            // code written before the value
+    uint32_t prefix_bits;
+    uint32_t bits;              // value bits following the prefix
+};
+
+// a zero is written as a single 0 bit, anything else by the first bucket
+// wide enough for it
+static const struct bucket timeBuckets[] = {
+    { 0x2, 2, 7 }, { 0x6, 3, 9 }, { 0xe, 4, 12 }, { 0xf, 4, 64 },
+};
+static const struct bucket valueBuckets[] = {
+    { 0x2, 2, 8 }, { 0x6, 3, 13 }, { 0xe, 4, 18 }, { 0xf, 4, 64 },
+};
+#define NUM_BUCKETS 4
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// writes the low n bits of value, most significant first
+static void put_bits(struct series_encoder *enc, uint64_t value, uint32_t n) {
+    while (n > 0) {
+        size_t byte = enc->bits >> 3;
+        uint32_t room = 8 - (uint32_t) (enc->bits & 7);
+        uint32_t take = n < room ? n : room;
+        uint32_t chunk = (uint32_t) (value >> (n - take)) & ((1u << take) - 1);
+
+        if (room == 8) {
+            enc->buf[byte] = 0;
+        }
+        enc->buf[byte] |= (uint8_t) (chunk << (room - take));
+        enc->bits += take;
+        n -= take;
+    }
+}
+
+static uint64_t get_bits(struct series_decoder *dec, uint32_t n) {
+    uint64_t value = 0;
+
+    while (n > 0) {
+        size_t byte = dec->bits >> 3;
+        uint32_t room = 8 - (uint32_t) (dec->bits & 7);
+        uint32_t take = n < room ? n : room;
+
+        // past the end reads zeros, series_decode() checks the position after
+        uint32_t bits = byte < dec->size ? dec->buf[byte] : 0;
+
+        value = (value << take) | ((bits >> (room - take)) & ((1u << take) - 1));
+        dec->bits += take;
+        n -= take;
+    }
+    return value;
+}
+
+static void put_coded(struct series_encoder *enc, const struct bucket *buckets, uint64_t value) {
+    size_t i = 0;
+
+    if (value == 0) {
+        put_bits(enc, 0, 1);
+        return;
+    }
+    while (i < NUM_BUCKETS - 1 && value >> buckets[i].bits != 0) {
+        i++;
+    }
+    put_bits(enc, buckets[i].prefix, buckets[i].prefix_bits);
+    put_bits(enc, value, buckets[i].bits);
+}
+
+static uint64_t get_coded(struct series_decoder *dec, const struct bucket *buckets) {
+    size_t ones = 0;
+
+    while (ones < NUM_BUCKETS && get_bits(dec, 1) == 1) {
+        ones++;
+    }
+    if (ones == 0) {
+        return 0;
+    }
+    return get_bits(dec, buckets[ones - 1].bits);
+}
+
+void series_encoder_init(struct series_encoder *enc, uint8_t *buf, size_t size) {
+    memset(enc, 0, sizeof(*enc));
+    enc->buf = buf;
+    enc->size = size;
+}
+
+// appends one sample. returns 0 on success, -1 when the buffer can't hold
+// another sample and a new block has to be started
+int32_t series_encode(struct series_encoder *enc, int64_t time, int32_t value) {
+    int64_t delta;
+
+    if (enc->bits + SERIES_MAX_SAMPLE_BYTES * 8 > enc->size * 8) {
+        return -1;
+    }
+    if (enc->count == 0) {
+        put_bits(enc, (uint64_t) time, 64);
+        put_bits(enc, (uint32_t) value, 32);
+    } else {
+        delta = time - enc->prev_time;
+        put_coded(enc, timeBuckets, zigzag(delta - enc->prev_delta));
+        put_coded(enc, valueBuckets, zigzag((int64_t) value - enc->prev_value));
+        enc->prev_delta = delta;
+    }
+    enc->prev_time = time;
+    enc->prev_value = value;
+    enc->count++;
+    return 0;
+}
+
+// bytes of buf used so far, what a block stores
+size_t series_encoder_bytes(const struct series_encoder *enc) {
+    return (enc->bits + 7) / 8;
+}
+
+// reads count samples from the size bytes of an encoded block
+void series_decoder_init(struct series_decoder *dec, const uint8_t *buf, size_t size, uint32_t count) {
+    memset(dec, 0, sizeof(*dec));
+    dec->buf = buf;
+    dec->size = size;
+    dec->remaining = count;
+}
+
+// returns 0 with the next sample, -1 at the end of the block or when the
+// block is shorter than its count says
+int32_t series_decode(struct series_decoder *dec, int64_t *time, int32_t *value) {
+    if (dec->remaining == 0 || dec->bits + (dec->count == 0 ? 96 : 2) > dec->size * 8) {
+        return -1;
+    }
+    if (dec->count == 0) {
+        dec->prev_time = (int64_t) get_bits(dec, 64);
+        dec->prev_value = (int32_t) (uint32_t) get_bits(dec, 32);
+    } else {
+        dec->prev_delta += unzigzag(get_coded(dec, timeBuckets));
+        dec->prev_time += dec->prev_delta;
+        dec->prev_value = (int32_t) ((int64_t) dec->prev_value + unzigzag(get_coded(dec, valueBuckets)));
+    }
+    if (dec->bits > dec->size * 8) {
+        return -1;
+    }
+    dec->remaining--;
+    dec->count++;
+    *time = dec->prev_time;
+    *value = dec->prev_value;
+    return 0;
+}
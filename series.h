@@ -0,0 +1,52 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// worst case size of one encoded sample: 4 + 64 bits of time, 4 + 64 bits of value
+#define SERIES_MAX_SAMPLE_BYTES 17
+
+// a block of compressed samples of one keg: this header, then bytes of
+// encoded bits. the first sample is stored whole, every later one as the
+// delta of its time delta and the zigzag delta of its value, each with a
+// short prefix choosing how many bits follow
+struct series_block {
+    uint16_t keg;
+    uint16_t reserved;
+    uint32_t count;             // samples in the block
+    uint32_t bytes;             // encoded bytes after the header
+    uint32_t time_unit_ms;      // what one unit of the encoded times is
+};
+
+// appends samples to a caller supplied buffer, one at a time. times are
+// in whatever unit the caller picks; a unit near the sample period makes
+// the time of a regular series cost one bit
+struct series_encoder {
+    uint8_t *buf;
+    size_t size;
+    size_t bits;                // bits written so far
+    uint32_t count;
+    int64_t prev_time;
+    int64_t prev_delta;
+    int32_t prev_value;
+};
+
+struct series_decoder {
+    const uint8_t *buf;
+    size_t size;
+    size_t bits;                // bits read so far
+    uint32_t remaining;
+    uint32_t count;
+    int64_t prev_time;
+    int64_t prev_delta;
+    int32_t prev_value;
+};
+
+void series_encoder_init(struct series_encoder *enc, uint8_t *buf, size_t size);
+int32_t series_encode(struct series_encoder *enc, int64_t time, int32_t value);
+size_t series_encoder_bytes(const struct series_encoder *enc);
+void series_decoder_init(struct series_decoder *dec, const uint8_t *buf, size_t size, uint32_t count);
+int32_t series_decode(struct series_decoder *dec, int64_t *time, int32_t *value);
+
+#endif
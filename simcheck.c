@@ -0,0 +1,204 @@
+// Checks of the display and sensor paths against the simulated backend.
+// Each check drives the real lcd.c / hal / calib.c calls and compares what
+// the simulated HD44780, the scripted sensors and the calibration give back
+// with values worked out by hand, so a change that garbles a frame, a
+// glyph, a reading or a conversion shows up without a BeagleBone.
+//
+// usage: simcheck
+// prints one line per check and exits 1 when any of them failed
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "lcd.h"
+#include "hal.h"
+#include "hal_sim.h"
+#include "hx711.h"
+#include "calib.h"
+
+#define CHECK_ADDR 0x27
+#define CHECK_ADDR_LARGE 0x21
+#define CHECK_CELLS 2
+
+static int32_t failures = 0;
+
+static void check(bool ok, const char *what) {
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+// a keg line over a 42% bar: 34 of 80 columns is six full blocks and a
+// cell with 4 columns, the hbar glyph that goes into CGRAM slot 0
+static void check_lcd_frame() {
+    static const char bar_row[] = "\xFF\xFF\xFF\xFF\xFF\xFF\x08         ";
+    struct lcd_display *lcd = lcd_open(I2C_BUS, CHECK_ADDR, LCD_COLS, LCD_ROWS);
+    char text[LCD_COLS + 1 + LCD_COLS + 1];
+    char row[LCD_MAX_COLS + 1];
+    unsigned char cgram[64];
+    bool glyph = true;
+    int32_t len;
+
+    if (lcd == NULL) {
+        check(false, "lcd_open on the simulated bus");
+        return;
+    }
+    len = snprintf(text, sizeof(text), "Keg 1  42%% 4.0C\n");
+    lcd_hbar(text + len, LCD_COLS, 42);
+    text[len + LCD_COLS] = '\0';
+    lcd_draw(lcd, text);
+    lcd_flush();
+
+    hal_sim_lcd_text(lcd_handle(lcd), 0, LCD_COLS, row);
+    check(strcmp(row, "Keg 1  42% 4.0C ") == 0, "lcd text row");
+    hal_sim_lcd_text(lcd_handle(lcd), 1, LCD_COLS, row);
+    check(memcmp(row, bar_row, LCD_COLS) == 0, "lcd bar row uses CGRAM slot 0");
+    hal_sim_lcd_cgram(lcd_handle(lcd), cgram);
+    for (int32_t i = 0; i < 8; i++) {
+        glyph = glyph && cgram[i] == 0x1E;
+    }
+    check(glyph, "lcd CGRAM slot 0 holds the 4 column hbar glyph");
+
+    // a digit changes and the bar goes away. the panel keeps its CGRAM
+    lcd_draw(lcd, "Keg 1  43% 4.0C\n");
+    lcd_flush();
+    hal_sim_lcd_text(lcd_handle(lcd), 0, LCD_COLS, row);
+    check(strcmp(row, "Keg 1  43% 4.0C ") == 0, "lcd text row after a one digit change");
+    hal_sim_lcd_text(lcd_handle(lcd), 1, LCD_COLS, row);
+    check(strcmp(row, "                ") == 0, "lcd bar row cleared");
+    hal_sim_lcd_cgram(lcd_handle(lcd), cgram);
+    for (int32_t i = 0; i < 8; i++) {
+        glyph = glyph && cgram[i] == 0x1E;
+    }
+    check(glyph, "lcd CGRAM slot 0 not rewritten");
+    lcd_close(lcd);
+}
+
+// a 16x2 and a 20x4 on one bus, each drawn with its own text. both frames
+// go out in the one combined transfer of a flush
+static void check_lcd_panels() {
+    struct lcd_display *small = lcd_open(I2C_BUS, CHECK_ADDR, LCD_COLS, LCD_ROWS);
+    struct lcd_display *large = lcd_open(I2C_BUS, CHECK_ADDR_LARGE, LCD_MAX_COLS, LCD_MAX_ROWS);
+    char row[LCD_MAX_COLS + 1];
+    uint64_t transfers;
+
+    if (small == NULL || large == NULL) {
+        check(false, "lcd_open of two panels on one bus");
+        if (small != NULL) {
+            lcd_close(small);
+        }
+        if (large != NULL) {
+            lcd_close(large);
+        }
+        return;
+    }
+    lcd_flush();
+    transfers = hal_sim_i2c_transfers();
+    lcd_draw(small, "Keg 1  42% 4.0C");
+    lcd_draw(large, "K1 4C 42%\nK2 4C 17%\nK3 5C 88%\nK4 4C 0%");
+    lcd_flush();
+    check(hal_sim_i2c_transfers() == transfers + 1, "two panels refreshed in one transfer");
+
+    hal_sim_lcd_text(lcd_handle(small), 0, LCD_COLS, row);
+    check(strcmp(row, "Keg 1  42% 4.0C ") == 0, "lcd 16x2 shows its own frame");
+    hal_sim_lcd_text(lcd_handle(large), 2, LCD_MAX_COLS, row);
+    check(strcmp(row, "K3 5C 88%           ") == 0, "lcd 20x4 third row");
+    hal_sim_lcd_text(lcd_handle(large), 3, LCD_MAX_COLS, row);
+    check(strcmp(row, "K4 4C 0%            ") == 0, "lcd 20x4 fourth row");
+    lcd_close(small);
+    lcd_close(large);
+}
+
+// with the noise, spikes and drain taken out of the script every cell reads
+// the same count. a dead cell makes the wait time out, and once the next
+// conversion is due, 100 ms at 10 SPS, it is the only one left busy
+static void check_weight() {
+    const int32_t dout_pins[CHECK_CELLS] = { DOUT_PIN, DOUT_PIN + 1 };
+    struct sim_script script = *hal_sim_script();
+    uint32_t samples[CHECK_CELLS];
+
+    check(hal->weight_open(PD_SCK_PIN, dout_pins, CHECK_CELLS) == 0, "weight_open");
+    check(hal->weight_wait_ready(1000) == 0, "weight_wait_ready");
+    hal->weight_read(samples);
+    check(samples[0] == 500000 && samples[1] == 500000, "scripted weight of 500000 counts");
+
+    script.dead_cells = 1u << 1;
+    hal_sim_configure(&script);
+    check(hal->weight_wait_ready(200) == 1, "weight_wait_ready times out on a dead cell");
+    check(hal->weight_busy() == 1u << 1, "weight_busy names only the dead cell");
+    script.dead_cells = 0;
+    hal_sim_configure(&script);
+}
+
+// the scripted bus holds two probes. probe p reads the mean plus p tenths
+// of a degree, rounded down to the resolution: 4.000 C and 4.1 C as
+// 4.0625 C at 12 bits, both from one conversion
+static void check_temperature() {
+    char ids[W1_MAX_PROBES][W1_ID_SIZE];
+    int32_t first = hal->temperature_open("/sim/28-000000000001", W1_MAX_RESOLUTION);
+    int32_t second = hal->temperature_open("/sim/28-000000000002", W1_MAX_RESOLUTION);
+    int64_t millidegrees[2] = { 0, 0 };
+    int32_t ready_ms;
+
+    check(hal->temperature_discover(ids, W1_MAX_PROBES) == 2 && strcmp(ids[0], "28-000000000001") == 0 &&
+          strcmp(ids[1], "28-000000000002") == 0, "temperature_discover finds both probes in id order");
+    check(first >= 0 && second >= 0, "temperature_open");
+    check(hal->temperature_convert(&ready_ms) == 0 && ready_ms == 10, "conversion time of 10 ms at 12 bits");
+    hal->temperature_read(first, &millidegrees[0]);
+    hal->temperature_read(second, &millidegrees[1]);
+    check(millidegrees[0] == 4000 && millidegrees[1] == 4062, "scripted temperatures of 4.000 C and 4.062 C");
+}
+
+// the calibration of the README: 8400 counts of tare and two reference
+// loads, so the counts halfway between them weigh halfway between
+static void check_calibration() {
+    struct calib_config config = {
+        .tare = 8400,
+        .points = 2,
+        .point = { { 210000, 10000 }, { 425000, 20000 } },
+        .empty = 13500,
+        .full = 63000,
+    };
+    struct calib_config two_point = { .empty = 100000, .full = 900000 };
+    struct calib_config descending = config;
+    struct calib_table table;
+
+    check(calib_build(&table, &config) == 0, "calib_build");
+    check(calib_grams(&table, 8400) == 0, "tare weighs 0 g");
+    check(calib_grams(&table, 8400 + 210000) == 10000, "first reference load weighs 10000 g");
+    check(calib_grams(&table, 8400 + 317500) == 15000, "halfway between the loads weighs 15000 g");
+    check(calib_percent(&table, 13500) == 0 && calib_percent(&table, 38250) == CALIB_PERCENT_ONE / 2 &&
+          calib_percent(&table, 70000) == CALIB_PERCENT_ONE, "percent of 0, 50 and over 100%");
+
+    // without points empty and full are counts above the tare
+    check(calib_build(&table, &two_point) == 0 && calib_grams(&table, 500000) == 500000 &&
+          calib_percent(&table, 500000) == CALIB_PERCENT_ONE / 2, "two point calibration in counts");
+
+    descending.point[1].raw = 200000;
+    check(calib_build(&table, &descending) != 0, "calib_build rejects descending points");
+}
+
+int main() {
+    struct sim_script script = *hal_sim_script();
+
+    script.weight_full_counts = 500000;
+    script.weight_empty_counts = 500000;
+    script.weight_noise_counts = 0;
+    script.spike_every = 0;
+    script.temperature_mean = 4;
+    script.temperature_swing = 0;
+    script.conversion_us = 10000;
+    script.probes = 2;
+    hal_sim_configure(&script);
+    hal = &hal_sim;
+
+    check_lcd_frame();
+    check_lcd_panels();
+    check_weight();
+    check_temperature();
+    check_calibration();
+    printf("%d failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
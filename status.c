@@ -0,0 +1,136 @@
+// Keg status in shared memory for dashboards and scripts.
+// The monitor maps a fixed layout segment under /dev/shm and rewrites one
+// entry per keg through a seqlock; readers map it read only and poll it
+// with plain loads, so any number of them cost the monitor nothing and
+// never make a system call after status_attach().
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "status.h"
+
+// creates (or takes over) the segment for kegs kegs. returns 0 on success
+int32_t status_create(struct status_map *map, uint32_t kegs) {
+    struct status_segment *segment;
+    struct timespec now;
+    int32_t fd;
+
+    map->segment = NULL;
+    if (kegs > STATUS_MAX_KEGS) {
+        return -1;
+    }
+    fd = shm_open(STATUS_SHM_NAME, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        printf("Error creating %s: %s\n", STATUS_SHM_NAME, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct status_segment)) != 0) {
+        printf("Error sizing %s: %s\n", STATUS_SHM_NAME, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    segment = mmap(NULL, sizeof(*segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        printf("Error mapping %s: %s\n", STATUS_SHM_NAME, strerror(errno));
+        return -1;
+    }
+
+    // readers of a previous run's segment see the magic go away first
+    memset(segment->magic, 0, sizeof(segment->magic));
+    atomic_thread_fence(memory_order_release);
+    memset((char *) segment + sizeof(segment->magic), 0, sizeof(*segment) - sizeof(segment->magic));
+    clock_gettime(CLOCK_REALTIME, &now);
+    segment->version = STATUS_VERSION;
+    segment->size = sizeof(*segment);
+    segment->kegs = kegs;
+    segment->pid = (uint32_t) getpid();
+    segment->start_time_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+    for (uint32_t k = 0; k < STATUS_MAX_KEGS; k++) {
+        segment->keg[k].values.health = STATUS_WEIGHT_MISSING | STATUS_TEMPERATURE_MISSING;
+    }
+    atomic_thread_fence(memory_order_release);
+    memcpy(segment->magic, STATUS_MAGIC, sizeof(segment->magic));
+    map->segment = segment;
+    return 0;
+}
+
+// replaces the entry of keg. the monitor is the only writer of each entry
+void status_publish(struct status_map *map, uint32_t keg, const struct status_values *values) {
+    struct status_keg *entry = &map->segment->keg[keg];
+    uint32_t lock = atomic_load_explicit(&entry->lock, memory_order_relaxed);
+
+    atomic_store_explicit(&entry->lock, lock + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    entry->values = *values;
+    entry->sequence++;
+    atomic_store_explicit(&entry->lock, lock + 2, memory_order_release);
+}
+
+// unmaps and removes the segment, readers then see it stop updating
+void status_destroy(struct status_map *map) {
+    if (map->segment != NULL) {
+        munmap(map->segment, sizeof(*map->segment));
+        map->segment = NULL;
+    }
+    shm_unlink(STATUS_SHM_NAME);
+}
+
+// maps the segment of a running monitor read only.
+// returns 0 on success, -1 when there is no compatible segment
+int32_t status_attach(struct status_map *map) {
+    struct status_segment *segment;
+    int32_t fd = shm_open(STATUS_SHM_NAME, O_RDONLY, 0);
+
+    map->segment = NULL;
+    if (fd < 0) {
+        return -1;
+    }
+    segment = mmap(NULL, sizeof(*segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        return -1;
+    }
+    if (memcmp(segment->magic, STATUS_MAGIC, sizeof(segment->magic)) != 0 ||
+        segment->version != STATUS_VERSION || segment->size != sizeof(*segment)) {
+        munmap(segment, sizeof(*segment));
+        return -1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    map->segment = segment;
+    return 0;
+}
+
+// copies the entry of keg, retrying while the monitor rewrites it.
+// returns 0 on success, -1 for a keg the monitor doesn't have
+int32_t status_read(const struct status_map *map, uint32_t keg, struct status_values *out, uint64_t *sequence) {
+    const struct status_keg *entry;
+    uint32_t before, after;
+
+    if (keg >= map->segment->kegs) {
+        return -1;
+    }
+    entry = &map->segment->keg[keg];
+    do {
+        before = atomic_load_explicit(&entry->lock, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        *out = entry->values;
+        *sequence = entry->sequence;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&entry->lock, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return 0;
+}
+
+void status_detach(struct status_map *map) {
+    if (map->segment != NULL) {
+        munmap(map->segment, sizeof(*map->segment));
+        map->segment = NULL;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define STATUS_SHM_NAME "/kegmon-status"    // /dev/shm/kegmon-status
+#define STATUS_MAGIC "KEGSTAT"
+#define STATUS_VERSION 1
+#define STATUS_MAX_KEGS 16
+
+// health bits, 0 when everything is fresh
+#define STATUS_WEIGHT_MISSING 0x01          // no weight sample yet or no load cells
+#define STATUS_WEIGHT_STALE 0x02            // last weight sample is overdue
+#define STATUS_TEMPERATURE_MISSING 0x04
+#define STATUS_TEMPERATURE_STALE 0x08
+
+// what the monitor knows about one keg. times are CLOCK_REALTIME in ns
+// so other processes can compare them with their own clock
+struct status_values {
+    uint32_t health;
+    uint32_t reserved;
+    double weight;                  // grams, filtered HX711 counts for an uncalibrated keg
+    double percent;                 // beer remaining
+    double temperature;             // degrees C
+    int64_t weight_time_ns;         // when the weight was sampled
+    int64_t temperature_time_ns;
+    int64_t update_time_ns;         // when this entry was published
+};
+
+// one keg, on its own cache line pair. lock is a seqlock: odd while the
+// monitor writes the entry, readers copy and retry on a change
+struct status_keg {
+    _Atomic uint32_t lock;
+    uint32_t reserved;
+    uint64_t sequence;              // updates published so far
+    struct status_values values;
+} __attribute__((aligned(64)));
+
+// fixed layout of the shared memory segment. a reader checks magic,
+// version and size before using anything else; magic is written last
+struct status_segment {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;                  // sizeof(struct status_segment)
+    uint32_t kegs;                  // entries in use
+    uint32_t pid;                   // of the monitor
+    int64_t start_time_ns;
+    struct status_keg keg[STATUS_MAX_KEGS];
+};
+
+// a mapping of the segment, for the monitor or a reader
+struct status_map {
+    struct status_segment *segment;
+};
+
+int32_t status_create(struct status_map *map, uint32_t kegs);
+void status_publish(struct status_map *map, uint32_t keg, const struct status_values *values);
+void status_destroy(struct status_map *map);
+
+int32_t status_attach(struct status_map *map);
+int32_t status_read(const struct status_map *map, uint32_t keg, struct status_values *out, uint64_t *sequence);
+void status_detach(struct status_map *map);
+
+#endif
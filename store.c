@@ -0,0 +1,721 @@
+// Append-only store for the keg history.
+// A stream is a series of preallocated segment files, each a header page
+// followed by an array of fixed size records that is memory mapped and
+// written in place, so readers use the records as they are on disk and
+// appending is a few stores into the page cache. store_sync() runs
+// periodically off the sampling path: it msyncs the records written since
+// the last sync and only then commits a header covering them, alternating
+// between two header slots, so a crash at any point leaves a segment whose
+// newest valid header only counts records that reached the card. Writing
+// back in batches also keeps the number of SD card writes down.
+// Segments that leave the retention window are not lost but compressed
+// into an archive with the series encoding, roughly 1.5 bytes a sample, by
+// a thread of the store so the compression and its fsync stay off the
+// thread that syncs. The writeback and the creation of segment files run
+// outside the store lock too, which only covers segment states and header
+// commits.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "store.h"
+#include "series.h"
+
+#define STORE_SEGMENT_SIZE (STORE_HEADER_SIZE + STORE_SEGMENT_RECORDS * sizeof(struct store_record))
+
+static uint64_t fnv1a(const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t header_checksum(const struct store_header *header) {
+    return fnv1a(header, offsetof(struct store_header, checksum));
+}
+
+static void segment_path(const struct sample_store *store, uint32_t sequence, char *path, size_t size) {
+    snprintf(path, size, "%s/%s-%08u.seg", store->dir, store->name, sequence);
+}
+
+// picks the newest of the two header slots that is intact.
+// returns NULL when neither is
+static const struct store_header *header_select(const unsigned char *page) {
+    const struct store_header *best = NULL;
+
+    for (size_t slot = 0; slot < 2; slot++) {
+        const struct store_header *header = (const struct store_header *) (page + slot * STORE_SLOT_OFFSET);
+
+        if (memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != STORE_VERSION ||
+            header->record_size != sizeof(struct store_record) ||
+            header->capacity != STORE_SEGMENT_RECORDS ||
+            header->committed > header->capacity ||
+            header->checksum != header_checksum(header)) {
+            continue;
+        }
+        if (best == NULL || header->generation > best->generation) {
+            best = header;
+        }
+    }
+    return best;
+}
+
+// writes the next header generation into its slot and syncs the header page
+static int32_t header_commit(struct store_segment *seg, uint64_t committed) {
+    struct store_header *header;
+
+    seg->generation++;
+    header = (struct store_header *) (seg->map + (seg->generation & 1) * STORE_SLOT_OFFSET);
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, STORE_MAGIC, sizeof(header->magic));
+    header->version = STORE_VERSION;
+    header->record_size = sizeof(struct store_record);
+    header->capacity = STORE_SEGMENT_RECORDS;
+    header->sequence = seg->sequence;
+    header->generation = seg->generation;
+    header->committed = committed;
+    header->first_ns = committed > 0 ? seg->records[0].time_ns : 0;
+    header->last_ns = committed > 0 ? seg->records[committed - 1].time_ns : 0;
+    header->checksum = header_checksum(header);
+    return msync(seg->map, STORE_HEADER_SIZE, MS_SYNC);
+}
+
+// maps segment sequence of the stream. a new segment is preallocated so
+// appending never extends the file, an existing one is recovered from its
+// newest intact header. returns 0 on success
+static int32_t segment_map(struct sample_store *store, struct store_segment *seg, uint32_t sequence, bool create) {
+    char path[STORE_PATH_SIZE + STORE_NAME_SIZE + 16];
+    const struct store_header *header;
+
+    segment_path(store, sequence, path, sizeof(path));
+    seg->fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (seg->fd < 0) {
+        printf("Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (posix_fallocate(seg->fd, 0, STORE_SEGMENT_SIZE) != 0) {
+        printf("Error allocating %s\n", path);
+        close(seg->fd);
+        return -1;
+    }
+    seg->map = mmap(NULL, STORE_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if (seg->map == MAP_FAILED) {
+        printf("Error mapping %s: %s\n", path, strerror(errno));
+        close(seg->fd);
+        return -1;
+    }
+    seg->records = (struct store_record *) (seg->map + STORE_HEADER_SIZE);
+    seg->sequence = sequence;
+
+    header = create ? NULL : header_select(seg->map);
+    seg->generation = header != NULL ? header->generation : 0;
+    seg->committed = header != NULL ? header->committed : 0;
+    atomic_store_explicit(&seg->count, seg->committed, memory_order_relaxed);
+    if (header == NULL && header_commit(seg, 0) != 0) {
+        printf("Error writing header of %s: %s\n", path, strerror(errno));
+    }
+    return 0;
+}
+
+static void segment_unmap(struct store_segment *seg) {
+    munmap(seg->map, STORE_SEGMENT_SIZE);
+    close(seg->fd);
+    seg->state = STORE_SEGMENT_FREE;
+}
+
+// syncs the records appended since the last commit and sets *count to
+// how many records are on disk, for the header commit that follows
+static int32_t segment_flush(struct store_segment *seg, uint64_t *count) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start, end;
+
+    *count = atomic_load_explicit(&seg->count, memory_order_acquire);
+    if (*count == seg->committed) {
+        return 0;
+    }
+    start = STORE_HEADER_SIZE + seg->committed * sizeof(struct store_record);
+    end = STORE_HEADER_SIZE + *count * sizeof(struct store_record);
+    start -= start % (size_t) page;
+    return msync(seg->map + start, end - start, MS_SYNC);
+}
+
+// compresses segment sequence into dir/name-NNNNNNNN.arc, one block per
+// keg, through a temporary file and rename(). returns 0 on success
+static int32_t segment_archive(struct sample_store *store, uint32_t sequence) {
+    char path[STORE_PATH_SIZE + STORE_NAME_SIZE + 16];
+    char tmp[STORE_PATH_SIZE + STORE_NAME_SIZE + 24];
+    unsigned char page[STORE_HEADER_SIZE];
+    struct store_archive_header archive = {0};
+    const struct store_header *header;
+    const struct store_record *records;
+    unsigned char *map;
+    uint8_t *buf;
+    size_t size;
+    int32_t fd, out, result = 0;
+
+    segment_path(store, sequence, path, sizeof(path));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    header = pread(fd, page, sizeof(page), 0) == sizeof(page) ? header_select(page) : NULL;
+    if (header == NULL || header->committed == 0) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, STORE_SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    size = header->committed * SERIES_MAX_SAMPLE_BYTES;
+    buf = malloc(size);
+    if (map == MAP_FAILED || buf == NULL) {
+        if (map != MAP_FAILED) {
+            munmap(map, STORE_SEGMENT_SIZE);
+        }
+        free(buf);
+        return -1;
+    }
+    records = (const struct store_record *) (map + STORE_HEADER_SIZE);
+
+    snprintf(path, sizeof(path), "%s/%s-%08u.arc", store->dir, store->name, sequence);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    memcpy(archive.magic, STORE_ARCHIVE_MAGIC, sizeof(archive.magic));
+    archive.version = STORE_VERSION;
+    if (out < 0 || lseek(out, sizeof(archive), SEEK_SET) < 0) {
+        result = -1;
+    }
+    for (uint16_t keg = 0; keg < STORE_MAX_KEGS && result == 0; keg++) {
+        struct series_encoder enc;
+        struct series_block block = { .keg = keg, .time_unit_ms = STORE_ARCHIVE_TIME_MS };
+        const int64_t unit = STORE_ARCHIVE_TIME_MS * 1000000LL;
+
+        series_encoder_init(&enc, buf, size);
+        for (uint64_t i = 0; i < header->committed; i++) {
+            if (records[i].keg == keg) {
+                series_encode(&enc, (records[i].time_ns + unit / 2) / unit, records[i].raw);
+            }
+        }
+        if (enc.count == 0) {
+            continue;
+        }
+        block.count = enc.count;
+        block.bytes = (uint32_t) series_encoder_bytes(&enc);
+        if (write(out, &block, sizeof(block)) != sizeof(block) ||
+            write(out, buf, block.bytes) != (ssize_t) block.bytes) {
+            result = -1;
+        }
+        archive.blocks++;
+    }
+    if (result == 0 && (pwrite(out, &archive, sizeof(archive), 0) != sizeof(archive) ||
+                        fsync(out) != 0 || rename(tmp, path) != 0)) {
+        result = -1;
+    }
+    if (out >= 0) {
+        close(out);
+    }
+    if (result != 0) {
+        printf("Error archiving %s\n", path);
+        unlink(tmp);
+    }
+    free(buf);
+    munmap(map, STORE_SEGMENT_SIZE);
+    return result;
+}
+
+// marks the segments before the retention window of newest, the newest
+// segment created, as expired and wakes the archiver. with the lock held
+static void segment_expire(struct sample_store *store, uint32_t newest) {
+    if (newest + 1 >= STORE_MAX_SEGMENTS && newest + 1 - STORE_MAX_SEGMENTS > store->expire_end) {
+        store->expire_end = newest + 1 - STORE_MAX_SEGMENTS;
+        pthread_cond_signal(&store->expired);
+    }
+}
+
+// creates the segment after the active one in a free slot once the active
+// one is half full, and expires the segment that falls out of the
+// retention window. waiting keeps restarts appending to the same segment.
+// only the syncing thread uses a free slot, so the file is created and
+// mapped without the lock
+static void segment_prepare(struct sample_store *store) {
+    struct store_segment *seg = NULL;
+    uint32_t sequence;
+
+    pthread_mutex_lock(&store->lock);
+    sequence = store->active->sequence + 1;
+    if (atomic_load_explicit(&store->active->count, memory_order_relaxed) >= STORE_SEGMENT_RECORDS / 2) {
+        for (size_t i = 0; i < 2 && seg == NULL; i++) {
+            if (store->segments[i].state == STORE_SEGMENT_FREE) {
+                seg = &store->segments[i];
+            }
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    if (seg == NULL || segment_map(store, seg, sequence, true) != 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    seg->state = STORE_SEGMENT_READY;
+    segment_expire(store, sequence);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// archives and deletes the expired segments, oldest first. runs on its own
+// thread so compressing and fsyncing an archive never holds the store lock
+static void *segment_archiver(void *arg) {
+    struct sample_store *store = arg;
+    char path[STORE_PATH_SIZE + STORE_NAME_SIZE + 16];
+
+    pthread_mutex_lock(&store->lock);
+    while (!store->stopping) {
+        uint32_t sequence = store->expire_next;
+
+        if (sequence >= store->expire_end) {
+            pthread_cond_wait(&store->expired, &store->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&store->lock);
+        // an expired segment is only deleted once its archive is written
+        if (segment_archive(store, sequence) == 0) {
+            segment_path(store, sequence, path, sizeof(path));
+            unlink(path);
+        }
+        pthread_mutex_lock(&store->lock);
+        store->expire_next = sequence + 1;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return NULL;
+}
+
+// finds the newest and the oldest segment of the stream. returns the
+// newest, -1 when there is none
+static int64_t stream_sequences(const struct sample_store *store, int64_t *oldest) {
+    DIR *dir = opendir(store->dir);
+    struct dirent *entry;
+    size_t prefix = strlen(store->name);
+    int64_t newest = -1;
+
+    *oldest = -1;
+    if (dir == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned int sequence;
+
+        if (strncmp(entry->d_name, store->name, prefix) == 0 && entry->d_name[prefix] == '-' &&
+            sscanf(entry->d_name + prefix + 1, "%8u.seg", &sequence) == 1) {
+            newest = (int64_t) sequence > newest ? sequence : newest;
+            *oldest = *oldest < 0 || (int64_t) sequence < *oldest ? sequence : *oldest;
+        }
+    }
+    closedir(dir);
+    return newest;
+}
+
+// opens stream name under dir, creating both if needed, and continues
+// after the last committed record. expired segments a previous run left
+// behind are archived along with the next ones. returns 0 on success
+int32_t store_open(struct sample_store *store, const char *dir, const char *name) {
+    int64_t newest, oldest;
+    int32_t err;
+
+    memset(store, 0, sizeof(*store));
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+    snprintf(store->name, sizeof(store->name), "%s", name);
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->expired, NULL);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("Error creating %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    newest = stream_sequences(store, &oldest);
+    if (segment_map(store, &store->segments[0], newest < 0 ? 0 : (uint32_t) newest, newest < 0) != 0) {
+        return -1;
+    }
+    store->segments[0].state = STORE_SEGMENT_ACTIVE;
+    store->active = &store->segments[0];
+    store->expire_next = oldest < 0 ? 0 : (uint32_t) oldest;
+    segment_expire(store, store->active->sequence);
+    segment_prepare(store);
+
+    // started before the event loop raises its priority, so it runs under
+    // normal scheduling
+    err = pthread_create(&store->archiver, NULL, segment_archiver, store);
+    store->archiving = err == 0;
+    if (!store->archiving) {
+        printf("Warning: no archiver for %s (%s), expired segments are kept\n", name, strerror(err));
+    }
+    return 0;
+}
+
+// appends one record with the current time. called by the single writer
+// of the stream; when the active segment is full it switches to the one
+// store_sync() prepared. returns 0 on success, -1 if the sample was dropped
+int32_t store_append(struct sample_store *store, uint16_t keg, double value, int32_t raw, uint16_t flags) {
+    struct store_segment *seg = store->active;
+    uint64_t count = atomic_load_explicit(&seg->count, memory_order_relaxed);
+    struct store_record *record;
+    struct timespec now;
+
+    if (count == STORE_SEGMENT_RECORDS) {
+        struct store_segment *next = &store->segments[seg == &store->segments[0]];
+
+        pthread_mutex_lock(&store->lock);
+        if (next->state != STORE_SEGMENT_READY) {
+            store->dropped++;
+            pthread_mutex_unlock(&store->lock);
+            return -1;
+        }
+        seg->state = STORE_SEGMENT_RETIRED;
+        next->state = STORE_SEGMENT_ACTIVE;
+        store->active = next;
+        pthread_mutex_unlock(&store->lock);
+        seg = next;
+        count = 0;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    record = &seg->records[count];
+    record->time_ns = (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+    record->value = value;
+    record->raw = raw;
+    record->keg = keg;
+    record->flags = flags;
+    atomic_store_explicit(&seg->count, count + 1, memory_order_release);
+    return 0;
+}
+
+// commits everything appended so far, releases a full segment once it is
+// on disk and prepares the next one. returns 0 on success
+int32_t store_sync(struct sample_store *store) {
+    struct store_segment *synced[2];
+    uint64_t flushed[2];
+    bool ok[2];
+    size_t count = 0;
+    int32_t result = 0;
+
+    pthread_mutex_lock(&store->lock);
+    for (size_t i = 0; i < 2; i++) {
+        struct store_segment *seg = &store->segments[i];
+
+        if (seg->state == STORE_SEGMENT_ACTIVE || seg->state == STORE_SEGMENT_RETIRED) {
+            synced[count++] = seg;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        ok[i] = segment_flush(synced[i], &flushed[i]) == 0;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    for (size_t i = 0; i < count; i++) {
+        struct store_segment *seg = synced[i];
+
+        if (!ok[i] || (flushed[i] != seg->committed && header_commit(seg, flushed[i]) != 0)) {
+            result = -1;
+            continue;
+        }
+        seg->committed = flushed[i];
+        // a retired segment is released once every record of it is committed
+        if (seg->state == STORE_SEGMENT_RETIRED && seg->committed == STORE_SEGMENT_RECORDS) {
+            segment_unmap(seg);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    segment_prepare(store);
+    return result;
+}
+
+// a segment the store has mapped, as a scan step found it
+struct scan_mapped {
+    uint32_t sequence;
+    const struct store_record *records;
+    uint64_t count;
+};
+
+// continues the scan of cursor through at most segments segments, calling
+// visit for every record with from_ns <= time < to_ns, oldest first.
+// segments that are not mapped are mapped read only and skipped by their
+// header times when they are out of range. the lock is only held to see
+// which segments the store has mapped; reading them needs no lock since
+// only store_sync() unmaps one, so a step must not run alongside it.
+// returns 1 while segments are left, 0 when the scan is done
+int32_t store_scan_step(struct sample_store *store, struct store_scan_cursor *cursor, int64_t from_ns, int64_t to_ns,
+                        uint32_t segments, store_visit visit, void *arg) {
+    char path[STORE_PATH_SIZE + STORE_NAME_SIZE + 16];
+    struct scan_mapped mapped[2];
+    size_t num_mapped = 0;
+    uint32_t newest, oldest, end;
+
+    pthread_mutex_lock(&store->lock);
+    newest = store->active->sequence;
+    for (size_t i = 0; i < 2; i++) {
+        struct store_segment *seg = &store->segments[i];
+
+        if (seg->state == STORE_SEGMENT_ACTIVE || seg->state == STORE_SEGMENT_RETIRED) {
+            mapped[num_mapped].sequence = seg->sequence;
+            mapped[num_mapped].records = seg->records;
+            mapped[num_mapped].count = atomic_load_explicit(&seg->count, memory_order_acquire);
+            num_mapped++;
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    oldest = newest >= STORE_MAX_SEGMENTS ? newest + 1 - STORE_MAX_SEGMENTS : 0;
+    // segments that expired since the last step are gone
+    if (!cursor->started || cursor->next < oldest) {
+        cursor->next = oldest;
+        cursor->started = true;
+    }
+    end = newest + 1;
+    if (cursor->next < end && end - cursor->next > segments) {
+        end = cursor->next + segments;
+    }
+    for (uint32_t sequence = cursor->next; sequence < end; sequence++) {
+        const struct store_record *records = NULL;
+        unsigned char *map = NULL;
+        uint64_t count = 0;
+
+        for (size_t i = 0; i < num_mapped; i++) {
+            if (mapped[i].sequence == sequence) {
+                records = mapped[i].records;
+                count = mapped[i].count;
+            }
+        }
+
+        if (records == NULL) {
+            unsigned char page[STORE_HEADER_SIZE];
+            const struct store_header *header;
+            int32_t fd;
+
+            segment_path(store, sequence, path, sizeof(path));
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                continue;
+            }
+            header = pread(fd, page, sizeof(page), 0) == sizeof(page) ? header_select(page) : NULL;
+            if (header != NULL && header->committed > 0 && header->last_ns >= from_ns && header->first_ns < to_ns) {
+                count = header->committed;
+                map = mmap(NULL, STORE_SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+                records = map == MAP_FAILED ? NULL : (const struct store_record *) (map + STORE_HEADER_SIZE);
+            }
+            close(fd);
+            if (records == NULL) {
+                continue;
+            }
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            if (records[i].time_ns >= from_ns && records[i].time_ns < to_ns) {
+                visit(&records[i], arg);
+            }
+        }
+        if (map != NULL) {
+            munmap(map, STORE_SEGMENT_SIZE);
+        }
+    }
+    cursor->next = end;
+    return end <= newest;
+}
+
+// calls visit for every record of the stream with from_ns <= time < to_ns,
+// oldest first, in one go
+int32_t store_scan(struct sample_store *store, int64_t from_ns, int64_t to_ns, store_visit visit, void *arg) {
+    struct store_scan_cursor cursor = {0};
+
+    while (store_scan_step(store, &cursor, from_ns, to_ns, STORE_MAX_SEGMENTS, visit, arg) != 0);
+    return 0;
+}
+
+// points records at the newest n records of keg that are still mapped,
+// oldest first, without copying them. the pointers stay valid until the
+// next store_sync() or store_close(). returns how many were found
+size_t store_latest(struct sample_store *store, uint16_t keg, size_t n, const struct store_record **records) {
+    struct store_segment *order[2];
+    size_t found = 0;
+
+    pthread_mutex_lock(&store->lock);
+    order[0] = store->active;
+    order[1] = &store->segments[store->active == &store->segments[0]];
+    for (size_t s = 0; s < 2 && found < n; s++) {
+        struct store_segment *seg = order[s];
+        uint64_t count;
+
+        if (seg->state != STORE_SEGMENT_ACTIVE && seg->state != STORE_SEGMENT_RETIRED) {
+            continue;
+        }
+        count = atomic_load_explicit(&seg->count, memory_order_acquire);
+        // filled from the end so the result comes out oldest first
+        for (uint64_t i = count; i > 0 && found < n; i--) {
+            if (seg->records[i - 1].keg == keg) {
+                records[n - ++found] = &seg->records[i - 1];
+            }
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    memmove(records, records + (n - found), found * sizeof(*records));
+    return found;
+}
+
+// commits what is left, stops the archiver after the segment it is on and
+// unmaps every segment
+void store_close(struct sample_store *store) {
+    store_sync(store);
+    if (store->archiving) {
+        pthread_mutex_lock(&store->lock);
+        store->stopping = true;
+        pthread_cond_signal(&store->expired);
+        pthread_mutex_unlock(&store->lock);
+        pthread_join(store->archiver, NULL);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        if (store->segments[i].state != STORE_SEGMENT_FREE) {
+            segment_unmap(&store->segments[i]);
+        }
+    }
+    pthread_cond_destroy(&store->expired);
+    pthread_mutex_destroy(&store->lock);
+}
+
+// calls visit for every sample of an archive written by segment_archive(),
+// keg by keg. returns 0 on success, -1 when the file is not a valid archive
+int32_t store_read_archive(const char *path, store_visit visit, void *arg) {
+    struct store_archive_header archive;
+    struct stat st;
+    unsigned char *map;
+    size_t offset = sizeof(archive);
+    int32_t fd = open(path, O_RDONLY | O_CLOEXEC);
+    int32_t result = 0;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(archive)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    memcpy(&archive, map, sizeof(archive));
+    if (memcmp(archive.magic, STORE_ARCHIVE_MAGIC, sizeof(archive.magic)) != 0 || archive.version != STORE_VERSION) {
+        result = -1;
+    }
+    for (uint32_t b = 0; b < archive.blocks && result == 0; b++) {
+        struct series_block block;
+        struct series_decoder dec;
+        struct store_record record = { .flags = STORE_ARCHIVED };
+        int64_t time;
+
+        if (offset + sizeof(block) > (size_t) st.st_size) {
+            result = -1;
+            break;
+        }
+        memcpy(&block, map + offset, sizeof(block));
+        offset += sizeof(block);
+        if (offset + block.bytes > (size_t) st.st_size) {
+            result = -1;
+            break;
+        }
+        record.keg = block.keg;
+        series_decoder_init(&dec, map + offset, block.bytes, block.count);
+        while (series_decode(&dec, &time, &record.raw) == 0) {
+            record.time_ns = time * block.time_unit_ms * 1000000LL;
+            record.value = record.raw;
+            visit(&record, arg);
+        }
+        offset += block.bytes;
+    }
+    munmap(map, (size_t) st.st_size);
+    return result;
+}
+
+// writes the calibration of kegs kegs to dir/calibration through a
+// temporary file and rename(), so a crash leaves the old or the new one.
+// returns 0 on success
+int32_t store_save_calibration(const char *dir, const struct calib_config *cal, uint32_t kegs) {
+    char path[STORE_PATH_SIZE + 32];
+    char tmp[STORE_PATH_SIZE + 32];
+    struct store_calibration_file file = {0};
+    int32_t fd;
+
+    if (kegs > STORE_MAX_KEGS) {
+        return -1;
+    }
+    memcpy(file.magic, STORE_MAGIC, sizeof(file.magic));
+    file.version = STORE_VERSION;
+    file.kegs = kegs;
+    memcpy(file.keg, cal, kegs * sizeof(*cal));
+    file.checksum = fnv1a(&file, offsetof(struct store_calibration_file, checksum));
+
+    snprintf(path, sizeof(path), "%s/calibration", dir);
+    snprintf(tmp, sizeof(tmp), "%s/calibration.tmp", dir);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        printf("Error creating %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("Error writing %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    if (write(fd, &file, sizeof(file)) != sizeof(file) || fsync(fd) != 0) {
+        printf("Error writing %s: %s\n", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) != 0) {
+        printf("Error replacing %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    // make the rename itself durable
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    return 0;
+}
+
+// loads the calibration of the first kegs kegs. returns 0 on success,
+// -1 when there is no intact calibration covering that many kegs
+int32_t store_load_calibration(const char *dir, struct calib_config *cal, uint32_t kegs) {
+    char path[STORE_PATH_SIZE + 32];
+    struct store_calibration_file file;
+    ssize_t len;
+    int32_t fd;
+
+    snprintf(path, sizeof(path), "%s/calibration", dir);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    len = read(fd, &file, sizeof(file));
+    close(fd);
+    if (len != sizeof(file) ||
+        memcmp(file.magic, STORE_MAGIC, sizeof(file.magic)) != 0 ||
+        file.version != STORE_VERSION ||
+        file.checksum != fnv1a(&file, offsetof(struct store_calibration_file, checksum)) ||
+        file.kegs < kegs) {
+        return -1;
+    }
+    memcpy(cal, file.keg, kegs * sizeof(*cal));
+    return 0;
+}
@@ -0,0 +1,130 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "calib.h"
+
+#define STORE_MAGIC "KEGSTORE"
+#define STORE_VERSION 1
+#define STORE_PATH_SIZE 128
+#define STORE_NAME_SIZE 16
+#define STORE_SEGMENT_RECORDS 65536     // records per segment file, 1.5 MiB
+#define STORE_MAX_SEGMENTS 32           // segments kept per stream, oldest are deleted
+#define STORE_HEADER_SIZE 4096          // first page of a segment, two header slots
+#define STORE_SLOT_OFFSET 512           // second slot on its own sector
+#define STORE_MAX_KEGS 16
+
+#define STORE_REJECTED 0x0001           // sample dropped by the outlier filter
+#define STORE_ARCHIVED 0x0002           // read back from an archive, value is the raw reading
+#define STORE_ARCHIVE_MAGIC "KEGARCHV"
+#define STORE_ARCHIVE_TIME_MS 1000      // archived times are rounded to the second
+
+// one sample, 24 bytes. segments are arrays of these, read in place
+struct store_record {
+    int64_t time_ns;            // CLOCK_REALTIME so it means something after a restart
+    double value;               // filtered value
+    int32_t raw;                // unfiltered reading (HX711 counts, millidegrees)
+    uint16_t keg;
+    uint16_t flags;
+};
+
+// segment header. each commit writes the slot the generation selects, so a
+// crash while writing one slot leaves the other intact. records past
+// committed are ignored when the segment is recovered
+struct store_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    uint32_t sequence;          // position of the segment in the stream
+    uint64_t generation;        // commits so far, the newest valid slot wins
+    uint64_t committed;         // records synced before this header was
+    int64_t first_ns;           // time of the first and last committed record
+    int64_t last_ns;
+    uint64_t checksum;          // FNV-1a of the fields above
+};
+
+enum store_segment_state {
+    STORE_SEGMENT_FREE,
+    STORE_SEGMENT_ACTIVE,       // being appended to
+    STORE_SEGMENT_READY,        // created and mapped ahead of time, empty
+    STORE_SEGMENT_RETIRED,      // full, waiting for its last sync
+};
+
+struct store_segment {
+    enum store_segment_state state;
+    int32_t fd;
+    uint32_t sequence;
+    unsigned char *map;
+    struct store_record *records;
+    _Atomic uint64_t count;     // records written, only the appender stores it
+    uint64_t committed;
+    uint64_t generation;
+    int64_t first_ns;
+};
+
+// one stream of records (e.g. every weight sample) in dir/name-NNNNNNNN.seg.
+// a single thread appends; store_sync() runs on another and is the only
+// one that creates, syncs and unmaps segment files, so appending never
+// makes a system call. segments leaving the retention window are archived
+// and deleted by the store's own archiver thread
+struct sample_store {
+    char dir[STORE_PATH_SIZE];
+    char name[STORE_NAME_SIZE];
+    pthread_mutex_t lock;       // segment states, the appender only takes it to switch segments
+    struct store_segment segments[2];
+    struct store_segment *active;
+    uint64_t dropped;           // appends with no segment to go to
+
+    // expired segments, under lock
+    pthread_t archiver;
+    pthread_cond_t expired;     // signaled when expire_end grows or on close
+    bool archiving;             // the archiver thread runs
+    bool stopping;
+    uint32_t expire_next;       // first expired segment not archived yet
+    uint32_t expire_end;        // every segment before this one has expired
+};
+
+// dir/calibration, replaced atomically with rename()
+struct store_calibration_file {
+    char magic[8];
+    uint32_t version;
+    uint32_t kegs;
+    struct calib_config keg[STORE_MAX_KEGS];
+    uint64_t checksum;
+};
+
+// segments leaving the retention window are compressed into
+// dir/name-NNNNNNNN.arc: this header, then per keg a series_block and its
+// encoded bytes. only time and raw reading are kept, the time rounded to
+// STORE_ARCHIVE_TIME_MS so a 1 Hz series costs a bit per timestamp
+struct store_archive_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t blocks;
+};
+
+typedef void (*store_visit)(const struct store_record *record, void *arg);
+
+// where a scan done in steps continues, zeroed before the first step
+struct store_scan_cursor {
+    bool started;
+    uint32_t next;              // next segment to visit
+};
+
+int32_t store_open(struct sample_store *store, const char *dir, const char *name);
+int32_t store_append(struct sample_store *store, uint16_t keg, double value, int32_t raw, uint16_t flags);
+int32_t store_sync(struct sample_store *store);
+int32_t store_scan(struct sample_store *store, int64_t from_ns, int64_t to_ns, store_visit visit, void *arg);
+int32_t store_scan_step(struct sample_store *store, struct store_scan_cursor *cursor, int64_t from_ns, int64_t to_ns,
+                        uint32_t segments, store_visit visit, void *arg);
+size_t store_latest(struct sample_store *store, uint16_t keg, size_t n, const struct store_record **records);
+void store_close(struct sample_store *store);
+int32_t store_read_archive(const char *path, store_visit visit, void *arg);
+int32_t store_save_calibration(const char *dir, const struct calib_config *cal, uint32_t kegs);
+int32_t store_load_calibration(const char *dir, struct calib_config *cal, uint32_t kegs);
+
+#endif
@@ -0,0 +1,81 @@
+// Persistent handles for sysfs and hwmon attributes.
+// Sampling used to snprintf the path, fopen, fgets, strtod and fclose on
+// every read. A handle keeps the file descriptor open for the life of the
+// process, reads with one pread() at offset 0 into its own buffer and
+// parses the value without any allocation.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sysfs_node.h"
+
+// opens path with flags (O_RDONLY, O_WRONLY or O_RDWR).
+// returns 0 on success, otherwise the errno of open
+int32_t sysfs_open(struct sysfs_node *node, const char *path, int32_t flags) {
+    snprintf(node->path, sizeof(node->path), "%s", path);
+    node->buffer[0] = '\0';
+    node->fd = open(path, flags | O_CLOEXEC);
+    if (node->fd < 0) {
+        printf("Error: could not open %s: %s\n", path, strerror(errno));
+        return errno;
+    }
+    return 0;
+}
+
+// parses a decimal integer with optional sign, ignoring leading spaces and
+// a trailing newline as sysfs attributes end with one.
+// returns 0 on success, -1 when buf holds anything else
+int32_t parse_int(const char *buf, size_t len, int64_t *value) {
+    size_t i = 0;
+    int64_t result = 0;
+    int32_t negative = 0;
+    size_t digits = 0;
+
+    while (i < len && buf[i] == ' ') {
+        i++;
+    }
+    if (i < len && (buf[i] == '-' || buf[i] == '+')) {
+        negative = buf[i] == '-';
+        i++;
+    }
+    for (; i < len && buf[i] >= '0' && buf[i] <= '9'; i++, digits++) {
+        result = result * 10 + (buf[i] - '0');
+    }
+    if (i < len && buf[i] == '\n') {
+        i++;
+    }
+    if (digits == 0 || (i < len && buf[i] != '\0')) {
+        return -1;
+    }
+    *value = negative ? -result : result;
+    return 0;
+}
+
+// reads the attribute and parses it as an integer.
+// returns 0 on success, -1 on a read or parse error
+int32_t sysfs_read_int(struct sysfs_node *node, int64_t *value) {
+    ssize_t len = pread(node->fd, node->buffer, sizeof(node->buffer) - 1, 0);
+
+    if (len <= 0) {
+        node->buffer[0] = '\0';
+        return -1;
+    }
+    node->buffer[len] = '\0';
+    return parse_int(node->buffer, (size_t) len, value);
+}
+
+// writes value to the attribute.
+// returns 0 on success, -1 on error
+int32_t sysfs_write(struct sysfs_node *node, const char *value) {
+    size_t len = strlen(value);
+    return pwrite(node->fd, value, len, 0) == (ssize_t) len ? 0 : -1;
+}
+
+void sysfs_close(struct sysfs_node *node) {
+    if (node->fd >= 0) {
+        close(node->fd);
+        node->fd = -1;
+    }
+}
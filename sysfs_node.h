@@ -0,0 +1,24 @@
+#ifndef SYSFS_NODE_H
+#define SYSFS_NODE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SYSFS_PATH_SIZE 100
+#define SYSFS_VALUE_SIZE 32
+
+// a sysfs or hwmon attribute opened once at init and then read or written
+// at offset 0 with a single pread/pwrite per sample
+struct sysfs_node {
+    int32_t fd;
+    char path[SYSFS_PATH_SIZE];
+    char buffer[SYSFS_VALUE_SIZE];   // last raw value read, NUL terminated
+};
+
+int32_t sysfs_open(struct sysfs_node *node, const char *path, int32_t flags);
+int32_t sysfs_read_int(struct sysfs_node *node, int64_t *value);
+int32_t sysfs_write(struct sysfs_node *node, const char *value);
+void sysfs_close(struct sysfs_node *node);
+int32_t parse_int(const char *buf, size_t len, int64_t *value);
+
+#endif
@@ -0,0 +1,119 @@
+// Binary trace of I2C traffic, GPIO edges and sensor reads.
+// Each thread writes 16 byte records into its own ring, so recording is a
+// clock read, a store and a release of the head index: no locks and no
+// stdio on the hot paths. When a ring is full the oldest records are
+// overwritten. trace_dump() writes every ring to a file that trace_decode
+// turns into text or Chrome trace JSON offline.
+
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+
+struct trace_ring {
+    char name[TRACE_NAME_SIZE];
+    _Atomic uint64_t head;          // records written so far
+    struct trace_record records[TRACE_RING_RECORDS];
+};
+
+static struct trace_ring rings[TRACE_MAX_THREADS];
+static _Atomic uint32_t numRings = 0;
+static __thread struct trace_ring *ring = NULL;
+
+// claims a ring for the calling thread and names it. threads that never
+// call this get an unnamed ring on their first record
+void trace_thread(const char *name) {
+    if (ring == NULL) {
+        uint32_t slot = atomic_fetch_add(&numRings, 1);
+        if (slot >= TRACE_MAX_THREADS) {
+            return;
+        }
+        ring = &rings[slot];
+    }
+    strncpy(ring->name, name, TRACE_NAME_SIZE - 1);
+}
+
+void trace(enum trace_type type, uint16_t arg, uint32_t value) {
+    struct trace_record *record;
+    struct timespec now;
+    uint64_t head;
+
+    if (ring == NULL) {
+        trace_thread("thread");
+        if (ring == NULL) {
+            return;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    record = &ring->records[head & (TRACE_RING_RECORDS - 1)];
+    record->time_ns = (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+    record->type = (uint16_t) type;
+    record->arg = arg;
+    record->value = value;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// records a bus transfer, four bytes per record
+void trace_i2c(int32_t handle, const unsigned char *buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; i += 4) {
+        uint32_t count = len - i < 4 ? len - i : 4;
+        uint32_t value = 0;
+        for (uint32_t b = 0; b < count; b++) {
+            value |= (uint32_t) buf[i + b] << (8 * b);
+        }
+        trace(TRACE_I2C_BYTES, (uint16_t) ((handle & 0xFF) << 8 | count), value);
+    }
+}
+
+// writes a copy of every ring to path while the threads keep tracing.
+// records that were overwritten during the copy are dropped from the dump.
+// uses only open/write/close so it can run from a signal handler.
+// returns 0 on success, -1 on error
+int32_t trace_dump(const char *path) {
+    static struct trace_record copy[TRACE_RING_RECORDS];
+    struct trace_file_header header = { TRACE_MAGIC, TRACE_VERSION, 0 };
+    uint32_t count = atomic_load(&numRings);
+    int32_t fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int32_t result = 0;
+
+    if (fd < 0) {
+        return -1;
+    }
+    header.rings = count < TRACE_MAX_THREADS ? count : TRACE_MAX_THREADS;
+    if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        result = -1;
+    }
+
+    for (uint32_t r = 0; r < header.rings && result == 0; r++) {
+        struct trace_ring *src = &rings[r];
+        struct trace_file_ring info = {0};
+        uint64_t end = atomic_load_explicit(&src->head, memory_order_acquire);
+        uint64_t start = end > TRACE_RING_RECORDS ? end - TRACE_RING_RECORDS : 0;
+        uint64_t after;
+
+        for (uint64_t i = start; i < end; i++) {
+            copy[i - start] = src->records[i & (TRACE_RING_RECORDS - 1)];
+        }
+        // anything the writer lapped while we copied is no longer valid,
+        // including the slot of the record it may be writing right now
+        after = atomic_load_explicit(&src->head, memory_order_acquire) + 1;
+        if (after > TRACE_RING_RECORDS && after - TRACE_RING_RECORDS > start) {
+            uint64_t valid = after - TRACE_RING_RECORDS;
+            memmove(copy, copy + (valid - start), (end > valid ? end - valid : 0) * sizeof(copy[0]));
+            start = valid < end ? valid : end;
+        }
+
+        memcpy(info.name, src->name, TRACE_NAME_SIZE);
+        info.records = (uint32_t) (end - start);
+        info.dropped = (uint32_t) start;
+        if (write(fd, &info, sizeof(info)) != sizeof(info) ||
+            write(fd, copy, info.records * sizeof(copy[0])) != (ssize_t) (info.records * sizeof(copy[0]))) {
+            result = -1;
+        }
+    }
+    close(fd);
+    return result;
+}
@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "KEGTRACE"
+#define TRACE_VERSION 1
+#define TRACE_MAX_THREADS 16
+#define TRACE_RING_RECORDS 4096         // per thread, power of two
+#define TRACE_NAME_SIZE 16
+
+enum trace_type {
+    TRACE_I2C_BYTES = 1,    // arg: handle << 8 | byte count (1-4), value: bytes, first in the low byte
+    TRACE_GPIO_EDGE,        // arg: line, value: 0 falling / 1 rising
+    TRACE_SENSOR_READ,      // arg: keg or probe, value: reading in thousandths (signed)
+    TRACE_SENSOR_ERROR,     // arg: keg or probe, value: error code
+    TRACE_HX711_READ,       // arg: cell, value: raw 24-bit sample
+    TRACE_LCD_UPDATE,       // arg: handle, value: cells sent
+};
+
+// one fixed size event, 16 bytes
+struct trace_record {
+    uint64_t time_ns;       // CLOCK_MONOTONIC
+    uint16_t type;
+    uint16_t arg;
+    uint32_t value;
+};
+
+// file layout written by trace_dump() and read by trace_decode:
+// trace_file_header, then per thread a trace_file_ring followed by its
+// records, oldest first
+struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t rings;
+};
+
+struct trace_file_ring {
+    char name[TRACE_NAME_SIZE];
+    uint32_t records;
+    uint32_t dropped;       // records overwritten before the dump
+};
+
+void trace_thread(const char *name);
+void trace(enum trace_type type, uint16_t arg, uint32_t value);
+void trace_i2c(int32_t handle, const unsigned char *buf, uint32_t len);
+int32_t trace_dump(const char *path);
+
+#endif
@@ -0,0 +1,116 @@
+// Offline decoder of the monitor's binary trace (trace.h).
+//
+// usage: trace_decode [-j] trace_file
+//   prints one line per record, oldest first per thread, or with -j a
+//   Chrome trace JSON document (load it in chrome://tracing or Perfetto)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+static const char *type_name(uint16_t type) {
+    switch (type) {
+    case TRACE_I2C_BYTES:    return "i2c";
+    case TRACE_GPIO_EDGE:    return "gpio_edge";
+    case TRACE_SENSOR_READ:  return "sensor_read";
+    case TRACE_SENSOR_ERROR: return "sensor_error";
+    case TRACE_HX711_READ:   return "hx711_read";
+    case TRACE_LCD_UPDATE:   return "lcd_update";
+    default:                 return "unknown";
+    }
+}
+
+// formats the payload of a record into out
+static void describe(const struct trace_record *r, char *out, size_t size, int json) {
+    switch (r->type) {
+    case TRACE_I2C_BYTES: {
+        size_t used = (size_t) snprintf(out, size, json ? "\"handle\": %u, \"bytes\": \"" : "handle %u bytes", r->arg >> 8);
+        for (uint32_t b = 0; b < (r->arg & 0xFF) && used < size; b++) {
+            used += (size_t) snprintf(out + used, size - used, json ? "%02x" : " %02x", (r->value >> (8 * b)) & 0xFF);
+        }
+        if (json && used < size) {
+            snprintf(out + used, size - used, "\"");
+        }
+        break;
+    }
+    case TRACE_SENSOR_READ:
+        snprintf(out, size, json ? "\"sensor\": %u, \"value\": %.3f" : "sensor %u value %.3f", r->arg, (int32_t) r->value / 1000.0);
+        break;
+    case TRACE_HX711_READ:
+        snprintf(out, size, json ? "\"cell\": %u, \"raw\": %u" : "cell %u raw %u", r->arg, r->value);
+        break;
+    default:
+        snprintf(out, size, json ? "\"arg\": %u, \"value\": %u" : "arg %u value %u", r->arg, r->value);
+        break;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct trace_file_header header;
+    int json = 0;
+    int opt;
+    int first = 1;
+    FILE *in;
+
+    while ((opt = getopt(argc, argv, "j")) != -1) {
+        if (opt == 'j') {
+            json = 1;
+        } else {
+            break;
+        }
+    }
+    if (optind >= argc) {
+        printf("usage: %s [-j] trace_file\n", argv[0]);
+        return 1;
+    }
+    in = fopen(argv[optind], "rb");
+    if (in == NULL || fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION) {
+        printf("Error: %s is not a version %d keg monitor trace\n", argv[optind], TRACE_VERSION);
+        return 1;
+    }
+
+    if (json) {
+        printf("{\"traceEvents\": [\n");
+    }
+    for (uint32_t r = 0; r < header.rings; r++) {
+        struct trace_file_ring ring;
+        char name[TRACE_NAME_SIZE + 1] = {0};
+
+        if (fread(&ring, sizeof(ring), 1, in) != 1) {
+            break;
+        }
+        memcpy(name, ring.name, TRACE_NAME_SIZE);
+        if (json) {
+            printf("%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                   first ? "" : ",\n", r, name);
+            first = 0;
+        } else {
+            printf("# thread %u %s: %u records, %u dropped\n", r, name, ring.records, ring.dropped);
+        }
+
+        for (uint32_t i = 0; i < ring.records; i++) {
+            struct trace_record record;
+            char args[128];
+
+            if (fread(&record, sizeof(record), 1, in) != 1) {
+                break;
+            }
+            describe(&record, args, sizeof(args), json);
+            if (json) {
+                printf(",\n  {\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u, \"args\": {%s}}",
+                       type_name(record.type), record.time_ns / 1e3, r, args);
+            } else {
+                printf("%llu.%09llu %-12s %s\n", (unsigned long long) (record.time_ns / 1000000000ull),
+                       (unsigned long long) (record.time_ns % 1000000000ull), type_name(record.type), args);
+            }
+        }
+    }
+    if (json) {
+        printf("\n]}\n");
+    }
+    fclose(in);
+    return 0;
+}